@@ -1,4 +1,4 @@
-QT       += core gui network sql
+QT       += core gui network sql concurrent
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -33,15 +33,52 @@ LIBS+=E:\ARM_QT_opencv_item\SeetaFace\lib\libSeeta*
 SOURCES += \
     main.cpp \
     attendancewin.cpp \
+    clientsession.cpp \
+    dnnbackend.cpp \
+    faceembedding.cpp \
+    facegallery.cpp \
+    facemodels.cpp \
+    facequality.cpp \
+    featuremath.cpp \
+    frameparser.cpp \
+    galleryjournal.cpp \
+    gallerypartitions.cpp \
+    hnswindex.cpp \
+    identitycache.cpp \
+    matpool.cpp \
     qfaceobject.cpp \
+    recognitionpool.cpp \
+    recognitionqueue.cpp \
     registerwin.cpp \
-    selectwin.cpp
+    resultcache.cpp \
+    seetabackend.cpp \
+    selectwin.cpp \
+    serverconfig.cpp
 
 HEADERS += \
     attendancewin.h \
+    clientsession.h \
+    dnnbackend.h \
+    facebackend.h \
+    faceembedding.h \
+    facegallery.h \
+    facemodels.h \
+    facequality.h \
+    featuremath.h \
+    frameparser.h \
+    galleryjournal.h \
+    gallerypartitions.h \
+    hnswindex.h \
+    identitycache.h \
+    matpool.h \
     qfaceobject.h \
+    recognitionpool.h \
+    recognitionqueue.h \
     registerwin.h \
-    selectwin.h
+    resultcache.h \
+    seetabackend.h \
+    selectwin.h \
+    serverconfig.h
 
 FORMS += \
     attendancewin.ui \
@@ -6,136 +6,275 @@
 #include <QSqlRecord>
 #include <QSqlQuery>
 #include <QSqlError>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QStatusBar>
+#include "serverconfig.h"
+#include "faceembedding.h"
 
 AttendanceWin::AttendanceWin(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::AttendanceWin)
+    , rqueue(ServerConfig::get().workers, ServerConfig::get().queueDepth, ServerConfig::get().queueDeadlineMs)
+    , pool(&rqueue)
 {
     ui->setupUi(this);
     //qtcpServer当有客户端连接会发送newconnection
     connect(&mserver,&QTcpServer::newConnection,this,&AttendanceWin::accept_client);
-    mserver.listen(QHostAddress::Any,9999); //监听,启动服务器
-    bsize = 0;
+    nextSessionId = 1;
 
     //给 sql模型绑定表格
     model.setTable("employee");
 
-    //创建一个 线程
-    QThread *thread = new QThread();
-    //把QFaceObject对象移动 到thread 线程中执行
-    fobj.moveToThread(thread);
-    //启动 线程
-    thread->start();
+    //注册页面直接用识别线程池的特征库和模型
+    ui->registerWidget->set_service(&pool);
+
+     connect(&rqueue,&RecognitionQueue::jobs_discarded,this,&AttendanceWin::discard_frames);
+     //关联识别线程池的 send_faces信号
+     connect(&pool,&RecognitionPool::send_faces,this,&AttendanceWin::recv_faces);
+     //模型加载和预热完成后才开始监听, 考勤机连上时第一帧不用等模型
+     connect(&pool,&RecognitionPool::ready,this,&AttendanceWin::service_ready);
 
-     connect(this,&AttendanceWin::query,&fobj,&QFaceObject::face_query);
-     //关联QFaceObject 对象里面的 send_faceid信号
-     connect(&fobj,&QFaceObject::send_faceid,this,&AttendanceWin::recv_faceid);
+    //启动识别线程, 每个线程从队列里取帧识别
+    pool.start();
+
+    connect(&statusTimer,&QTimer::timeout,this,&AttendanceWin::update_status);
+    statusTimer.start(StatusIntervalMs);
 
 }
 
 AttendanceWin::~AttendanceWin()
 {
+    pool.stop();
     delete ui;
 }
 
+void AttendanceWin::service_ready(qint64 msecs)
+{
+    mserver.listen(QHostAddress::Any,9999); //监听,启动服务器
+    qDebug()<<"识别服务就绪, 启动耗时(ms):"<<msecs<<"模型套数:"<<FaceModels::instance().loaded();
+}
+
+void AttendanceWin::update_status()
+{
+    QString status = QString("考勤机: %1").arg(sessions.size());
+    const IdentityCache &cache = pool.identities();
+    if(cache.enabled())
+    {
+        IdentityCache::Stats st = cache.stats();
+        status += QString("  最近识别缓存命中率: %1%  省下查找时间(ms): %2")
+                .arg(st.hit_rate() * 100, 0, 'f', 1).arg(st.savedUs / 1000);
+    }
+    statusBar()->showMessage(status);
+}
+
 //接收客户端连接
 void AttendanceWin::accept_client()
 {
-    //获取与客户端通信的套接字
-    msocket = mserver.nextPendingConnection();
+    while(mserver.hasPendingConnections())
+    {
+        //获取与客户端通信的套接字, 交给一个新的会话管理
+        QTcpSocket *socket = mserver.nextPendingConnection();
+        ClientSession *session = new ClientSession(nextSessionId++, socket, this);
+        sessions.insert(session->id(), session);
 
-    //当客户端有数据发送,会发送readyRead信号
-    connect(msocket,&QTcpSocket::readyRead,this,&AttendanceWin::read_data);
+        connect(session,&ClientSession::frame_received,this,&AttendanceWin::recv_frame);
+        connect(session,&ClientSession::embedding_received,this,&AttendanceWin::recv_embedding);
+        connect(session,&ClientSession::closed,this,&AttendanceWin::remove_client);
+    }
 }
 
-//读取 客户端发送的数据
-void AttendanceWin::read_data()
+void AttendanceWin::remove_client(quint64 sessionid)
 {
-    QDataStream stream(msocket); //把套接字绑定到数据流
-    stream.setVersion(QDataStream::Qt_5_14);
+    //会话自己会deleteLater, 这里只从表里删除, 之后到达的识别结果直接丢弃
+    sessions.remove(sessionid);
+    rqueue.remove_session(sessionid);
+}
 
-    if(bsize == 0){
-        if(msocket->bytesAvailable()<(qint64)sizeof(bsize)) return;
-        //采集数据长度
-        stream>>bsize;
+//被覆盖或者超时丢弃的帧不会再有识别结果
+void AttendanceWin::discard_frames(quint64 sessionid, int count)
+{
+    ClientSession *session = sessions.value(sessionid, nullptr);
+    if(session != nullptr)
+    {
+        session->discard(count);
     }
+}
 
+//处理 客户端发送的一帧图片
+void AttendanceWin::recv_frame(quint64 sessionid, const QByteArray &data, const FaceHint &hint)
+{
+    QString partition = door(sessionid);
+
+    //同样的jpg刚刚识别过(考勤机重发, 或者画面没有变化), 直接回复上次的结果
+    //第一次识别时已经记过考勤, 这里只回复不再记
+    quint64 frameKey = ResultCache::frame_key(data, hint, partition);
+    QVector<FaceMatch> cached;
+    if(pool.results().lookup_frame(frameKey, pool.gallery()->version(), cached))
     {
-        if(msocket->bytesAvailable() < bsize)//说明数据还没有发送完成,返回继续等待
+        ClientSession *session = sessions.value(sessionid, nullptr);
+        if(session != nullptr)
+            session->send_reply(face_reply(cached, false));
         return;
     }
 
-    QByteArray data;
-    stream>>data;
-    bsize = 0;
-    if(data.size()==0)//如果没有读到数据
+    //直接从接收缓冲区解码到内存池的缓冲区, 中间不再拷贝jpg数据
+    //每帧只解码一次, 识别和界面预览共用这一份图像
+    cv::Mat faceImage = framePool.decode(data.constData(), data.size());
+    if(faceImage.empty())
     {
+        qDebug()<<"图像解码失败";
         return;
     }
+
     //显示图片
-    QPixmap mmp;
-    mmp.loadFromData(data,"jpg");
-    mmp = mmp.scaled(ui->picLb->size());
-    ui->picLb->setPixmap(mmp);
+    update_preview(faceImage);
 
     //识别人脸
-    cv::Mat faceImage;
-    std::vector<uchar> decode;
-    decode.resize(data.size());
-    memcpy(decode.data(),data.data(),data.size());
+    //放进队列, 识别跟不上时旧帧会被新帧替换
+    RecognitionJob job;
+    job.sessionid = sessionid;
+    job.image = faceImage;
+    job.hint = hint;
+    job.frameKey = frameKey;
+    job.partition = partition;
+    rqueue.push(job);
 
-    faceImage = cv::imdecode(decode,cv::IMREAD_COLOR);
 
-    //int faceid = fobj.face_query(faceImage); // 消耗资源较多
-    emit query(faceImage);
+}
 
+//处理 考勤机自己提取的特征, 不用解码图像, 识别线程只查特征库
+void AttendanceWin::recv_embedding(quint64 sessionid, const QByteArray &data)
+{
+    RecognitionJob job;
+    job.sessionid = sessionid;
+    //模型编号和服务器的识别模型不同(换了模型文件或者用ONNX模型), 或者维度和特征库不同, 特征都不能比较
+    const ServerConfig &config = ServerConfig::get();
+    if(!FaceEmbedding::decode(data.constData(), data.size(), job.features, config.embeddingModel)
+       || job.features.size() != pool.gallery()->dim())
+    {
+        //告诉考勤机改回发送图片
+        qDebug()<<"考勤机"<<sessionid<<"特征格式不匹配";
+        QJsonObject reply;
+        reply.insert("error", "embedding_version");
+        reply.insert("version", int(FaceEmbedding::Version));
+        reply.insert("model", config.embeddingModel);
+        ClientSession *session = sessions.value(sessionid, nullptr);
+        if(session != nullptr)
+            session->send_reply(QJsonDocument(reply).toJson(QJsonDocument::Compact));
+        return;
+    }
+    job.partition = door(sessionid);
+    rqueue.push(job);
+}
 
+//考勤机所属的特征库分区, 没有配置时为空
+QString AttendanceWin::door(quint64 sessionid) const
+{
+    ClientSession *session = sessions.value(sessionid, nullptr);
+    if(session == nullptr || !pool.partitions().enabled())
+    {
+        return QString();
+    }
+    return pool.partitions().door(session->address());
 }
 
-void AttendanceWin::recv_faceid(int64_t faceid)
+//刷新考勤图像预览
+void AttendanceWin::update_preview(const cv::Mat &image)
 {
-    //qDebug()<<faceid;
+    //窗口最小化或者不在考勤图像页面时不需要预览
+    if(isMinimized() || !ui->picLb->isVisible())
+    {
+        return;
+    }
+    //多个考勤机同时发图时限制刷新频率
+    if(previewTimer.isValid() && previewTimer.elapsed() < PreviewIntervalMs)
+    {
+        return;
+    }
+    previewTimer.restart();
+
+    //先缩小再转颜色, 只处理界面大小的数据
+    cv::resize(image, previewMat, cv::Size(ui->picLb->width(), ui->picLb->height()), 0, 0, cv::INTER_NEAREST);
+    cv::cvtColor(previewMat, previewMat, cv::COLOR_BGR2RGB);
+    QImage qImg(previewMat.data, previewMat.cols, previewMat.rows, previewMat.step, QImage::Format_RGB888);
+    ui->picLb->setPixmap(QPixmap::fromImage(qImg));
+}
 
-    //从数据库中 查询faceid对应的个人信息
-    //给模型设置过滤器
-    qDebug()<<"识别到的人脸id:"<<faceid;
-    if(faceid < 0)
+void AttendanceWin::recv_faces(quint64 sessionid, const QVector<FaceMatch> &faces)
+{
+    //客户端已经断开, 结果没有人接收
+    ClientSession *session = sessions.value(sessionid, nullptr);
+    if(session == nullptr)
     {
-        QString sdmsg = QString("{\"employeeID\":\"\",\"name\":\"\",\"department\":\"\",\"time\":\"\"}");
-        msocket->write(sdmsg.toUtf8()); // 把打包好的数据 发送给客户端
-        return ;
+        return;
     }
 
+    session->send_reply(face_reply(faces, true)); // 把打包好的数据 发送给客户端
+}
 
-    model.setFilter(QString("faceID=%1").arg(faceid));
-    // 查询
-    model.select();
-    //判断是否查询 到数据
-    if(model.rowCount() == 1)
+//把数据写入数据库--考勤表
+bool AttendanceWin::record_attendance(const QString &employeeID)
+{
+    QString insertSql = QString("insert into attendance(employeeID) values('%1')").arg(employeeID);
+    QSqlQuery query;
+    if(!query.exec(insertSql))
     {
-        //工号,姓名, 部门,时间
-        //{employeeID:%1,name:%2,department:软件,time:%3}
-        QSqlRecord record = model.record(0);
-        QString sdmsg = QString("{\"employeeID\":\"%1\",\"name\":\"%2\",\"department\":\"软件\",\"time\":\"%3\"}")
-                .arg(record.value("employeeID").toString()).arg(record.value("name").toString())
-                .arg(QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss"));
+        qDebug()<<query.lastError().text();
+        return false;
+    }
+    return true;
+}
 
+QByteArray AttendanceWin::face_reply(const QVector<FaceMatch> &faces, bool attendance)
+{
+    //最大的人脸放在外层的字段里, 只显示一个人的考勤机不用改; faces里是所有认出来的人和人脸框
+    QString now = QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss");
+    QJsonObject reply;
+    reply.insert("employeeID", "");
+    reply.insert("name", "");
+    reply.insert("department", "");
+    reply.insert("time", "");
+    QJsonArray people;
+    //没有认出任何人时告诉考勤机最大那张脸哪里不合格, 考勤机换一帧再发
+    QString quality;
+    for(const FaceMatch &m : faces)
+    {
+        qDebug()<<"识别到的人脸id:"<<m.faceid<<"相似度:"<<m.similarity;
+        if(m.quality != FaceQuality::Ok && quality.isEmpty())
+            quality = FaceQuality::name(FaceQuality::Reason(m.quality));
+        if(m.faceid < 0) continue;
 
-        //把数据写入数据库--考勤表
-        QString insertSql = QString("insert into attendance(employeeID) values('%1')").arg(record.value("employeeID").toString());
-        QSqlQuery query;
+        //从数据库中 查询faceid对应的个人信息
+        model.setFilter(QString("faceID=%1").arg(m.faceid));
+        model.select();
+        if(model.rowCount() != 1) continue;
+        QSqlRecord record = model.record(0);
 
-        if(!query.exec(insertSql))
+        if(attendance && !record_attendance(record.value("employeeID").toString()))
         {
-            QString sdmsg = QString("{\"employeeID\":\"\",\"name\":\"\",\"department\":\"\",\"time\":\"\"}");
-            msocket->write(sdmsg.toUtf8()); // 把打包好的数据 发送给客户端
-            qDebug()<<query.lastError().text();
-            return ;
-        }else
-        {
-            msocket->write(sdmsg.toUtf8()); // 把打包好的数据 发送给客户端
-
+            continue;
         }
 
+        //工号,姓名, 部门,时间
+        QJsonObject person;
+        person.insert("employeeID", record.value("employeeID").toString());
+        person.insert("name", record.value("name").toString());
+        person.insert("department", "软件");
+        person.insert("time", now);
+        person.insert("similarity", m.similarity);
+        person.insert("box", QJsonArray({ m.box.x, m.box.y, m.box.width, m.box.height }));
+        if(people.isEmpty())
+        {
+            for(const char *key : { "employeeID", "name", "department", "time" })
+                reply.insert(key, person.value(key));
+        }
+        people.append(person);
     }
+    reply.insert("faces", people);
+    if(people.isEmpty() && !quality.isEmpty())
+        reply.insert("quality", quality);
+
+    return QJsonDocument(reply).toJson(QJsonDocument::Compact);
 }
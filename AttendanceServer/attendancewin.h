@@ -2,12 +2,19 @@
 #define ATTENDANCEWIN_H
 
 #include "qfaceobject.h"
+#include "clientsession.h"
+#include "matpool.h"
+#include "recognitionqueue.h"
+#include "recognitionpool.h"
 
 #include <QMainWindow>
 #include <QTcpSocket>
 #include <QTcpServer>
 #include <QSqlTableModel>
 #include <QSqlRecord>
+#include <QHash>
+#include <QElapsedTimer>
+#include <QTimer>
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class AttendanceWin; }
@@ -20,20 +27,41 @@ class AttendanceWin : public QMainWindow
 public:
     AttendanceWin(QWidget *parent = nullptr);
     ~AttendanceWin();
-signals:
-    void query(cv::Mat& image);
-
 protected slots:
     void accept_client();
-    void read_data();
-    void recv_faceid(int64_t faceid);
+    void recv_frame(quint64 sessionid, const QByteArray &data, const FaceHint &hint);
+    void recv_embedding(quint64 sessionid, const QByteArray &data);
+    void remove_client(quint64 sessionid);
+    void discard_frames(quint64 sessionid, int count);
+    void recv_faces(quint64 sessionid, const QVector<FaceMatch> &faces);
+    void service_ready(qint64 msecs);
+    //状态栏: 连接的考勤机数和最近识别缓存的命中率, 省下的时间
+    void update_status();
 private:
+    void update_preview(const cv::Mat &image);
+    QString door(quint64 sessionid) const;
+    //按识别结果打包回复; attendance为true时认出来的每个人都记一次考勤(重发的帧已经记过, 为false)
+    QByteArray face_reply(const QVector<FaceMatch> &faces, bool attendance);
+    bool record_attendance(const QString &employeeID);
+
+    //预览最多每秒刷新10次, 状态栏每秒刷新
+    enum { PreviewIntervalMs = 100, StatusIntervalMs = 1000 };
+
     Ui::AttendanceWin *ui;
     QTcpServer mserver;
-    QTcpSocket *msocket;
-    quint64 bsize;
+    //每个考勤机一个会话, 用会话id区分识别结果该回给谁
+    QHash<quint64, ClientSession*> sessions;
+    quint64 nextSessionId;
+    //解码图像的内存池
+    MatPool framePool;
+    QElapsedTimer previewTimer;
+    QTimer statusTimer;
+    cv::Mat previewMat;
 
-    QFaceObject fobj;
+    //等待识别的帧, 每个考勤机只保留最新的一帧
+    RecognitionQueue rqueue;
+    //识别线程池, 每个线程一套模型
+    RecognitionPool pool;
     QSqlTableModel model;
 };
 #endif // ATTENDANCEWIN_H
@@ -0,0 +1,17 @@
+QT       += core
+QT       -= gui
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+# FrameParser 的微基准: 把连续的帧切成大小不一的片段(头部也会被切开)喂给解析器,
+# 检查每一帧都完整取出并打印吞吐量, 不需要opencv和seetaface
+
+INCLUDEPATH += ../..
+
+SOURCES += \
+    main.cpp \
+    ../../frameparser.cpp
+
+HEADERS += \
+    ../../frameparser.h
@@ -0,0 +1,111 @@
+﻿#include "frameparser.h"
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QtEndian>
+#include <QVector>
+#include <QDebug>
+
+//每次喂给解析器的片段大小, 轮流使用: 1和5字节会把12字节的头部切开, 1460是一个TCP分段
+static const int FragmentSizes[] = { 1, 5, 11, 12, 13, 100, 1460, 4096, 65536 };
+static const int FragmentKinds = sizeof(FragmentSizes) / sizeof(FragmentSizes[0]);
+
+struct Expected
+{
+    int type;
+    int size;       //jpg部分的长度
+    char fill;      //jpg部分每个字节的值
+};
+
+static void append_be32(QByteArray &out, quint32 v)
+{
+    char b[4];
+    qToBigEndian(v, b);
+    out.append(b, 4);
+}
+
+//按考勤机的格式写一帧: quint64(类型<<56 | 长度) + quint32 长度 + 数据
+static void append_frame(QByteArray &out, const Expected &e)
+{
+    QByteArray body;
+    if(e.type == FrameParser::HintedFrame)
+    {
+        append_be32(body, 100);
+        append_be32(body, 80);
+        append_be32(body, 200);
+        append_be32(body, 240);
+        append_be32(body, 0);
+    }
+    body.append(QByteArray(e.size, e.fill));
+
+    char head[8];
+    qToBigEndian((quint64(e.type) << 56) | quint64(body.size()), head);
+    out.append(head, 8);
+    append_be32(out, body.size());
+    out.append(body);
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    int rounds = argc > 1 ? QString(argv[1]).toInt() : 200;
+
+    //一组20K~60K的jpg帧, 每三帧有一帧带人脸位置
+    QVector<Expected> frames;
+    QByteArray stream;
+    for(int i = 0; i < 64; i++)
+    {
+        Expected e;
+        e.type = (i % 3 == 0) ? FrameParser::HintedFrame : FrameParser::ImageFrame;
+        e.size = 20 * 1024 + (i * 7919) % (40 * 1024);
+        e.fill = char('a' + i % 26);
+        frames.append(e);
+        append_frame(stream, e);
+    }
+
+    FrameParser parser;
+    FrameParser::Frame frame;
+    qint64 parsed = 0;
+    int kind = 0;
+    QElapsedTimer timer;
+    timer.start();
+    for(int r = 0; r < rounds; r++)
+    {
+        int expect = 0;
+        qint64 pos = 0;
+        while(pos < stream.size())
+        {
+            qint64 len = qMin<qint64>(FragmentSizes[kind++ % FragmentKinds], stream.size() - pos);
+            parser.feed(stream.constData() + pos, len);
+            pos += len;
+
+            //和AttendanceWin一样, 每次收到数据把完整的帧全部取出来
+            while(parser.next(frame))
+            {
+                const Expected &e = frames[expect++];
+                if(frame.type != e.type || frame.size != e.size || frame.data[0] != e.fill
+                   || frame.data[frame.size - 1] != e.fill || frame.hint.valid != (e.type == FrameParser::HintedFrame))
+                {
+                    qDebug()<<"第"<<r<<"轮第"<<expect - 1<<"帧解析错误";
+                    return 1;
+                }
+                parsed++;
+            }
+            if(parser.hasError())
+            {
+                qDebug()<<"解析器报告格式错误";
+                return 1;
+            }
+        }
+        if(expect != frames.size() || parser.buffered() != 0)
+        {
+            qDebug()<<"第"<<r<<"轮只取出"<<expect<<"帧, 剩余字节:"<<parser.buffered();
+            return 1;
+        }
+    }
+
+    double secs = qMax<qint64>(1, timer.nsecsElapsed()) / 1e9;
+    double mb = double(stream.size()) * rounds / (1024 * 1024);
+    qDebug()<<"帧数:"<<parsed<<"数据量(MB):"<<mb<<"耗时(s):"<<secs;
+    qDebug()<<"吞吐量(MB/s):"<<mb / secs<<"每秒帧数:"<<parsed / secs;
+    return 0;
+}
@@ -0,0 +1,105 @@
+﻿#include "clientsession.h"
+#include <QHostAddress>
+#include <QDebug>
+
+//套接字发送缓冲区超过这个值就先把回复留在队列里
+static const qint64 MaxWriteBacklog = 64 * 1024;
+//客户端长时间不读,最多缓存这么多条回复,超出丢掉最旧的
+static const int MaxQueuedReplies = 32;
+
+ClientSession::ClientSession(quint64 sessionid, QTcpSocket *socket, QObject *parent)
+    : QObject(parent), sid(sessionid), msocket(socket), pending(0)
+{
+    //套接字由会话管理,会话销毁时一起释放
+    msocket->setParent(this);
+
+    //当客户端有数据发送,会发送readyRead信号
+    connect(msocket,&QTcpSocket::readyRead,this,&ClientSession::read_data);
+    connect(msocket,&QTcpSocket::bytesWritten,this,&ClientSession::flush_replies);
+    connect(msocket,&QTcpSocket::disconnected,this,&ClientSession::on_disconnected);
+
+    qDebug()<<"客户端连接:"<<sid<<peer();
+}
+
+ClientSession::~ClientSession()
+{
+}
+
+QString ClientSession::peer() const
+{
+    return QString("%1:%2").arg(msocket->peerAddress().toString()).arg(msocket->peerPort());
+}
+
+QString ClientSession::address() const
+{
+    //监听 Any 时IPv4的考勤机地址是 ::ffff:a.b.c.d, 转回普通的IPv4写法
+    QHostAddress host = msocket->peerAddress();
+    bool ipv4 = false;
+    quint32 v4 = host.toIPv4Address(&ipv4);
+    return ipv4 ? QHostAddress(v4).toString() : host.toString();
+}
+
+//读取 客户端发送的数据
+//一次把套接字里的数据读完, 并把其中所有完整的帧都处理掉, 不用等下一次readyRead
+void ClientSession::read_data()
+{
+    FrameParser::Frame frame;
+    do
+    {
+        parser.feed(msocket);
+        while(parser.next(frame))
+        {
+            if(frame.size == 0)//如果没有读到数据
+                continue;
+
+            pending++;
+            //不拷贝, 槽函数里直接使用接收缓冲区
+            if(frame.type == FrameParser::EmbeddingFrame)
+                emit embedding_received(sid, QByteArray::fromRawData(frame.data, frame.size));
+            else
+                emit frame_received(sid, QByteArray::fromRawData(frame.data, frame.size), frame.hint);
+        }
+    }while(!parser.hasError() && msocket->bytesAvailable() > 0);
+
+    if(parser.hasError())
+    {
+        qDebug()<<"客户端"<<sid<<"数据格式错误, 断开连接";
+        msocket->abort();
+    }
+}
+
+void ClientSession::send_reply(const QByteArray &msg)
+{
+    if(pending > 0) pending--;
+
+    if(replies.size() >= MaxQueuedReplies)
+    {
+        replies.dequeue();
+        qDebug()<<"客户端"<<sid<<"回复积压,丢弃最旧的一条";
+    }
+    replies.enqueue(msg);
+    flush_replies();
+}
+
+void ClientSession::discard(int count)
+{
+    pending = qMax(0, pending - count);
+}
+
+void ClientSession::flush_replies()
+{
+    if(msocket->state() != QAbstractSocket::ConnectedState) return;
+
+    while(!replies.isEmpty() && msocket->bytesToWrite() < MaxWriteBacklog)
+    {
+        msocket->write(replies.dequeue()); // 把打包好的数据 发送给客户端
+    }
+}
+
+void ClientSession::on_disconnected()
+{
+    qDebug()<<"客户端断开:"<<sid<<"未回复"<<pending;
+    replies.clear();
+    emit closed(sid);
+    deleteLater();
+}
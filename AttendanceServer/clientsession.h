@@ -0,0 +1,54 @@
+﻿#ifndef CLIENTSESSION_H
+#define CLIENTSESSION_H
+
+#include <QObject>
+#include <QTcpSocket>
+#include <QByteArray>
+#include <QQueue>
+#include "frameparser.h"
+
+//一个考勤机连接对应一个会话: 会话持有自己的套接字,帧解析状态和待发送的回复队列
+
+class ClientSession : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ClientSession(quint64 sessionid, QTcpSocket *socket, QObject *parent = nullptr);
+    ~ClientSession();
+
+    quint64 id() const { return sid; }
+    QString peer() const;
+    //考勤机的IP地址, 不含端口, 用来对应所在的门口; IPv4映射的IPv6地址返回IPv4写法
+    QString address() const;
+    //还没有收到识别结果的帧数
+    int inflight() const { return pending; }
+
+    //把回复放入队列,按顺序发送给这个客户端
+    void send_reply(const QByteArray &msg);
+    //有帧在识别前被丢弃, 不会再有回复
+    void discard(int count);
+
+signals:
+    //收到一帧完整的图片数据, data直接引用接收缓冲区, 只在槽函数执行期间有效
+    //hint是考勤机检测到的人脸位置, 没有时 valid 为false
+    void frame_received(quint64 sessionid, const QByteArray &data, const FaceHint &hint);
+    //收到考勤机提取好的特征(还没有解码), 同样只在槽函数执行期间有效
+    void embedding_received(quint64 sessionid, const QByteArray &data);
+    //客户端断开
+    void closed(quint64 sessionid);
+
+private slots:
+    void read_data();
+    void flush_replies();
+    void on_disconnected();
+
+private:
+    quint64 sid;
+    QTcpSocket *msocket;
+    FrameParser parser;
+
+    QQueue<QByteArray> replies;
+    int pending;
+};
+
+#endif // CLIENTSESSION_H
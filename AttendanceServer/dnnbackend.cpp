@@ -0,0 +1,99 @@
+﻿#include "dnnbackend.h"
+#include <QDebug>
+#include <string.h>
+
+//ArcFace对齐模板: 112x112的人脸里5点关键点的位置
+static const float AlignTemplate[5][2] = {
+    { 38.2946f, 51.6963f }, { 73.5318f, 51.5014f }, { 56.0252f, 71.7366f },
+    { 41.5493f, 92.3655f }, { 70.7299f, 92.2041f }
+};
+
+static cv::Mat to_mat(const SeetaImageData &image)
+{
+    return cv::Mat(image.height, image.width, CV_8UC(image.channels), image.data);
+}
+
+static cv::dnn::Net load(const QString &model)
+{
+    cv::dnn::Net net = cv::dnn::readNetFromONNX(model.toLocal8Bit().toStdString());
+    net.setPreferableBackend(cv::dnn::DNN_BACKEND_OPENCV);
+    net.setPreferableTarget(cv::dnn::DNN_TARGET_CPU);
+    return net;
+}
+
+DnnDetector::DnnDetector(const DnnParams &params)
+    : params(params), net(load(params.model))
+{
+}
+
+std::vector<SeetaFaceInfo> DnnDetector::detect(const SeetaImageData &image)
+{
+    std::vector<SeetaFaceInfo> faces;
+    cv::Mat blob = cv::dnn::blobFromImage(to_mat(image), params.scale, cv::Size(params.inputSize, params.inputSize),
+                                          cv::Scalar(params.mean, params.mean, params.mean), params.swapRB);
+    net.setInput(blob);
+    cv::Mat out = net.forward();
+    if(out.total() % 7 != 0) return faces;
+
+    //[1,1,N,7] 按行读取
+    cv::Mat rows = out.reshape(1, int(out.total() / 7));
+    for(int i = 0; i < rows.rows; i++)
+    {
+        const float *r = rows.ptr<float>(i);
+        if(r[2] < params.score) continue;
+        int x1 = qBound(0, int(r[3] * image.width), image.width);
+        int y1 = qBound(0, int(r[4] * image.height), image.height);
+        int x2 = qBound(0, int(r[5] * image.width), image.width);
+        int y2 = qBound(0, int(r[6] * image.height), image.height);
+        if(x2 <= x1 || y2 <= y1) continue;
+
+        SeetaFaceInfo face;
+        face.pos = { x1, y1, x2 - x1, y2 - y1 };
+        face.score = r[2];
+        faces.push_back(face);
+    }
+    return faces;
+}
+
+DnnRecognizer::DnnRecognizer(const DnnParams &params)
+    : params(params), net(load(params.model)), dim(0)
+{
+    //用一张空图跑一次得到特征维度, 顺便完成延迟初始化
+    cv::Mat blank = cv::Mat::zeros(params.inputSize, params.inputSize, CV_8UC3);
+    dim = int(forward(blank).total());
+    qDebug()<<"ONNX识别模型"<<params.model<<"特征维度:"<<dim;
+}
+
+cv::Mat DnnRecognizer::align(const cv::Mat &image, const SeetaPointF *points) const
+{
+    float ratio = params.inputSize / 112.0f;
+    std::vector<cv::Point2f> src, dst;
+    for(int i = 0; i < 5; i++)
+    {
+        src.push_back(cv::Point2f(float(points[i].x), float(points[i].y)));
+        dst.push_back(cv::Point2f(AlignTemplate[i][0] * ratio, AlignTemplate[i][1] * ratio));
+    }
+    cv::Mat face;
+    cv::Mat transform = cv::estimateAffinePartial2D(src, dst);
+    if(transform.empty()) return face;
+    cv::warpAffine(image, face, transform, cv::Size(params.inputSize, params.inputSize));
+    return face;
+}
+
+cv::Mat DnnRecognizer::forward(const cv::Mat &face)
+{
+    cv::Mat blob = cv::dnn::blobFromImage(face, params.scale, cv::Size(params.inputSize, params.inputSize),
+                                          cv::Scalar(params.mean, params.mean, params.mean), params.swapRB);
+    net.setInput(blob);
+    return net.forward();
+}
+
+bool DnnRecognizer::extract(const SeetaImageData &image, const SeetaPointF *points, float *features)
+{
+    cv::Mat face = align(to_mat(image), points);
+    if(face.empty()) return false;
+    cv::Mat out = forward(face);
+    if(int(out.total()) != dim) return false;
+    memcpy(features, out.ptr<float>(), dim * sizeof(float));
+    return true;
+}
@@ -0,0 +1,54 @@
+﻿#ifndef DNNBACKEND_H
+#define DNNBACKEND_H
+
+#include "facebackend.h"
+#include <opencv.hpp>
+
+//OpenCV DNN的实现, 在CPU上运行 .onnx 模型, 用来和SeetaFace比较速度, 也可以换成量化过的模型
+//线程数是OpenCV全局的(cv::setNumThreads), 在 FaceModels 加载模型时设置
+//关键点只有SeetaFace的实现, 对齐用的5点关键点和两种识别模型通用
+
+//模型的输入参数: blob = (像素 - mean) * scale
+struct DnnParams
+{
+    QString model;
+    int inputSize = 112;    //检测模型是缩放后的边长, 识别模型是对齐后人脸的边长
+    double scale = 1.0;
+    double mean = 0;
+    bool swapRB = true;     //模型要求RGB输入
+    float score = 0.6f;     //检测模型的置信度阈值
+};
+
+//输出为SSD格式的检测模型: [1,1,N,7], 每行 [图片序号, 类别, 置信度, x1, y1, x2, y2], 坐标按图像大小归一化
+class DnnDetector : public FaceDetectorBackend
+{
+public:
+    explicit DnnDetector(const DnnParams &params);
+    QString name() const override { return "dnn(" + params.model + ")"; }
+    std::vector<SeetaFaceInfo> detect(const SeetaImageData &image) override;
+
+private:
+    DnnParams params;
+    cv::dnn::Net net;
+};
+
+//输入对齐后的人脸(ArcFace的112x112模板), 输出一维特征, 例如SFace, ArcFace
+class DnnRecognizer : public FaceRecognizerBackend
+{
+public:
+    explicit DnnRecognizer(const DnnParams &params);
+    QString name() const override { return "dnn(" + params.model + ")"; }
+    int feature_size() const override { return dim; }
+    bool extract(const SeetaImageData &image, const SeetaPointF *points, float *features) override;
+
+private:
+    //按5点关键点把人脸变换到模板位置
+    cv::Mat align(const cv::Mat &image, const SeetaPointF *points) const;
+    cv::Mat forward(const cv::Mat &face);
+
+    DnnParams params;
+    cv::dnn::Net net;
+    int dim;
+};
+
+#endif // DNNBACKEND_H
@@ -0,0 +1,41 @@
+﻿#ifndef FACEBACKEND_H
+#define FACEBACKEND_H
+
+#include <QString>
+#include <vector>
+#include <seeta/CStruct.h>
+
+//识别各步骤的实现接口, 检测, 关键点, 特征提取可以分别换成不同的实现
+//图像, 人脸框和关键点沿用SeetaFace的C结构体(只是普通的数据), 不同实现之间不用转换
+//同一个对象同一时间只在一个线程里使用(由 FaceModels 借出), 实现不需要加锁
+
+class FaceDetectorBackend
+{
+public:
+    virtual ~FaceDetectorBackend() {}
+    //实现的名字和模型文件, 打印日志用
+    virtual QString name() const = 0;
+    //检测到的所有人脸, 不要求排序
+    virtual std::vector<SeetaFaceInfo> detect(const SeetaImageData &image) = 0;
+};
+
+class FaceLandmarkerBackend
+{
+public:
+    virtual ~FaceLandmarkerBackend() {}
+    virtual QString name() const = 0;
+    //5点关键点: 左眼, 右眼, 鼻尖, 左嘴角, 右嘴角
+    virtual std::vector<SeetaPointF> mark(const SeetaImageData &image, const SeetaRect &face) = 0;
+};
+
+class FaceRecognizerBackend
+{
+public:
+    virtual ~FaceRecognizerBackend() {}
+    virtual QString name() const = 0;
+    virtual int feature_size() const = 0;
+    //按5点关键点对齐后提取特征, 结果不要求归一化
+    virtual bool extract(const SeetaImageData &image, const SeetaPointF *points, float *features) = 0;
+};
+
+#endif // FACEBACKEND_H
@@ -0,0 +1,60 @@
+﻿#include "faceembedding.h"
+#include <QtEndian>
+#include <QFloat16>
+#include <QFileInfo>
+#include <string.h>
+
+int FaceEmbedding::model_id(const QString &modelPath)
+{
+    QFileInfo info(modelPath);
+    QString name = info.fileName().toLower();
+    if(name == "fr_2_10.dat") return Model;
+
+    QByteArray key = QString("%1:%2").arg(name).arg(info.size()).toUtf8();
+    quint16 id = qChecksum(key.constData(), key.size());
+    //不能和 fr_2_10 的编号相同
+    return id == Model ? id + 1 : id;
+}
+
+QByteArray FaceEmbedding::encode(const float *features, int dim, int model)
+{
+    QByteArray out(HeaderSize + dim * 2, 0);
+    uchar *p = reinterpret_cast<uchar*>(out.data());
+    qToBigEndian<quint16>(Version, p);
+    qToBigEndian<quint16>(model, p + 2);
+    qToBigEndian<quint16>(dim, p + 4);
+    qToBigEndian<quint16>(0, p + 6);
+
+    p += HeaderSize;
+    for(int i = 0; i < dim; i++)
+    {
+        qfloat16 h(features[i]);
+        quint16 bits;
+        memcpy(&bits, &h, sizeof(bits));
+        qToBigEndian<quint16>(bits, p + i * 2);
+    }
+    return out;
+}
+
+bool FaceEmbedding::decode(const char *data, int size, QVector<float> &features, int model)
+{
+    if(size < HeaderSize) return false;
+    const uchar *p = reinterpret_cast<const uchar*>(data);
+    int version = qFromBigEndian<quint16>(p);
+    int from = qFromBigEndian<quint16>(p + 2);
+    int dim = qFromBigEndian<quint16>(p + 4);
+    if(version != Version || from != model || dim == 0 || size != HeaderSize + dim * 2)
+        return false;
+
+    features.resize(dim);
+    p += HeaderSize;
+    for(int i = 0; i < dim; i++)
+    {
+        quint16 bits = qFromBigEndian<quint16>(p + i * 2);
+        //qfloat16 就是16位的IEEE半精度浮点
+        qfloat16 h;
+        memcpy(static_cast<void*>(&h), &bits, sizeof(h));
+        features[i] = float(h);
+    }
+    return true;
+}
@@ -0,0 +1,31 @@
+﻿#ifndef FACEEMBEDDING_H
+#define FACEEMBEDDING_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+//考勤机自己提取特征时发送的特征格式, 考勤机和服务器共用这份代码
+//quint16 格式版本 + quint16 模型编号 + quint16 维度 + quint16 保留(0) + 每维一个半精度浮点, 都是大端
+//1024维的特征约2KB, 比一帧jpg小得多
+//不同模型提取的特征不能互相比较, 服务器只接受和自己特征库同一个模型的特征
+
+namespace FaceEmbedding
+{
+    enum { Version = 1, HeaderSize = 8 };
+
+    //fr_2_10.dat 的模型编号, 旧版本考勤机固定发这个编号
+    enum { Model = 0x0210 };
+
+    //按识别模型文件得到模型编号: fr_2_10.dat 是 Model, 其他模型按文件名和文件大小算
+    //考勤机和服务器都用自己配置的模型文件计算, 编号不同说明特征不能比较
+    int model_id(const QString &modelPath);
+
+    //把特征编码成发送的数据
+    QByteArray encode(const float *features, int dim, int model = Model);
+
+    //解码, 版本或模型编号不对返回false, 得到的特征还需要重新归一化
+    bool decode(const char *data, int size, QVector<float> &features, int model = Model);
+}
+
+#endif // FACEEMBEDDING_H
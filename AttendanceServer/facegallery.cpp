@@ -0,0 +1,1182 @@
+﻿#include "facegallery.h"
+#include "galleryjournal.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QMutexLocker>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <climits>
+
+const char *FaceGallery::DefaultPath = "./face.gallery";
+
+//文件头标识和版本
+//1: QDataStream 逐个写出, 需要全部读进内存; 2: 按内存布局保存, 可以直接映射
+static const quint32 GalleryMagic = 0x46474C31; // "FGL1"
+static const quint32 StreamVersion = 1;
+static const quint32 MappedVersion = 2;
+
+//一次算这么多行的相似度, 结果放在栈上
+static const int ScoreBlock = 256;
+
+//批量查找时每次读这么多行, 留在缓存里给所有查询用
+static const int BatchRows = 32;
+
+//新增这么多行后复制一份索引发布给查询, 还没进索引的行逐个比较
+static const int IndexPublishRows = 256;
+
+namespace
+{
+//版本2的文件头, 64字节, 本机字节序(x86和ARM都是小端)
+//后面依次是 faceID(int64) / 缩放系数(float) / int8特征(每行stride字节) / 浮点特征(每行stride个float),
+//每段起始位置按64字节对齐
+struct GalleryHeader
+{
+    quint32 magic;
+    quint32 version;
+    quint32 dim;
+    quint32 stride;
+    quint64 count;
+    qint64 nextId;
+    quint64 idsOffset;
+    quint64 scalesOffset;
+    quint64 codesOffset;
+    quint64 rowsOffset;
+};
+static_assert(sizeof(GalleryHeader) == 64, "gallery header must be 64 bytes");
+
+inline quint64 align_section(quint64 offset)
+{
+    return (offset + FeatureMath::Alignment - 1) / FeatureMath::Alignment * FeatureMath::Alignment;
+}
+
+void layout(GalleryHeader &h)
+{
+    h.idsOffset = align_section(sizeof(GalleryHeader));
+    h.scalesOffset = align_section(h.idsOffset + h.count * sizeof(int64_t));
+    h.codesOffset = align_section(h.scalesOffset + h.count * sizeof(float));
+    h.rowsOffset = align_section(h.codesOffset + h.count * h.stride);
+}
+
+//文件头里的各段位置和当前版本的布局一致, 并且都在文件范围内
+bool valid_layout(const GalleryHeader &h, qint64 fileSize)
+{
+    GalleryHeader expect = h;
+    layout(expect);
+    return h.idsOffset == expect.idsOffset && h.scalesOffset == expect.scalesOffset
+        && h.codesOffset == expect.codesOffset && h.rowsOffset == expect.rowsOffset
+        && h.rowsOffset + h.count * h.stride * sizeof(float) <= (quint64)fileSize;
+}
+
+//补0写到offset位置
+bool pad_to(QIODevice &file, quint64 offset)
+{
+    static const char zeros[FeatureMath::Alignment] = {};
+    while((quint64)file.pos() < offset)
+    {
+        qint64 n = qMin<qint64>(sizeof(zeros), offset - file.pos());
+        if(file.write(zeros, n) != n) return false;
+    }
+    return true;
+}
+
+//查询向量补齐到stride并对齐, 供SIMD直接加载
+class AlignedQuery
+{
+public:
+    AlignedQuery(const float *features, int dim, int stride)
+    {
+        data = static_cast<float *>(qMallocAligned(stride * sizeof(float), FeatureMath::Alignment));
+        memcpy(data, features, dim * sizeof(float));
+        memset(data + dim, 0, (stride - dim) * sizeof(float));
+    }
+    ~AlignedQuery() { qFreeAligned(data); }
+    float *data;
+};
+
+//把 (id, score) 插入按分数从高到低排列的前k名
+template<class Id>
+inline void push_topk(Id id, float s, int k, int &found, Id *ids, float *scores)
+{
+    if(found == k && s <= scores[k - 1]) return;
+
+    int pos = (found < k) ? found++ : k - 1;
+    while(pos > 0 && scores[pos - 1] < s)
+    {
+        scores[pos] = scores[pos - 1];
+        ids[pos] = ids[pos - 1];
+        pos--;
+    }
+    scores[pos] = s;
+    ids[pos] = id;
+}
+
+//从start开始的一块, 不跨过映射和内存两段的分界
+inline int block_rows(int start, int rows, int split)
+{
+    int end = start < split ? split : rows;
+    return qMin(ScoreBlock, end - start);
+}
+}
+
+FaceGallery::MappedFile::~MappedFile()
+{
+    delete file; //关闭文件时取消映射
+}
+
+FaceGallery::Store::Store(int capacity, int mappedRows, int stride)
+    : capacity(capacity), mappedRows(mappedRows)
+{
+    size_t tail = qMax(1, capacity - mappedRows);
+    ids = new int64_t[capacity];
+    scales = new float[capacity];
+    matrix = static_cast<float *>(qMallocAligned(tail * stride * sizeof(float), FeatureMath::Alignment));
+    codes = static_cast<int8_t *>(qMallocAligned(tail * stride, FeatureMath::Alignment));
+    deleted = new std::atomic<quint64>[capacity];
+    for(int i = 0; i < capacity; i++)
+        deleted[i].store(0, std::memory_order_relaxed);
+}
+
+FaceGallery::Store::~Store()
+{
+    delete[] ids;
+    delete[] scales;
+    qFreeAligned(matrix);
+    qFreeAligned(codes);
+    delete[] deleted;
+}
+
+FaceGallery::FaceGallery(int dim)
+    : purgeRatio(0), listener(nullptr), journal(nullptr), journalWorker(nullptr), journalBatch(32)
+{
+    std::shared_ptr<Snapshot> s(new Snapshot);
+    s->version = 0;
+    s->compactMode = false;
+    s->rerankSize = 16;
+    s->indexMinRows = 0;
+    s->generation = 0;
+    clear_rows(*s, dim);
+    current = s;
+}
+
+FaceGallery::~FaceGallery()
+{
+    close_journal();
+}
+
+void FaceGallery::normalize(float *features, int dim)
+{
+    double sum = 0;
+    for(int i = 0; i < dim; i++)
+        sum += features[i] * features[i];
+    if(sum <= 0) return;
+    float scale = float(1.0 / std::sqrt(sum));
+    for(int i = 0; i < dim; i++)
+        features[i] *= scale;
+}
+
+std::shared_ptr<FaceGallery::Snapshot> FaceGallery::next_version() const
+{
+    std::shared_ptr<Snapshot> next(new Snapshot(*pin()));
+    next->version++;
+    return next;
+}
+
+void FaceGallery::publish(const std::shared_ptr<Snapshot> &next)
+{
+    std::atomic_store(&current, SnapshotPtr(next));
+}
+
+void FaceGallery::clear_rows(Snapshot &next, int dim)
+{
+    next.dimension = dim;
+    next.stride = FeatureMath::padded(dim);
+    next.count = 0;
+    next.deadRows = 0;
+    next.nextId = 0;
+    next.generation++;
+    next.file.reset();
+    next.mappedMatrix = nullptr;
+    next.mappedCodes = nullptr;
+    next.store.reset();
+    next.index.reset();
+    next.indexedRows = 0;
+    if(liveIndex) liveIndex->clear();
+    liveRows.clear();
+}
+
+bool FaceGallery::init(int dim)
+{
+    QMutexLocker locker(&writeMutex);
+    SnapshotPtr cur = pin();
+    if(cur->dimension == 0 && cur->count == 0)
+    {
+        std::shared_ptr<Snapshot> next = next_version();
+        clear_rows(*next, dim);
+        publish(next);
+        return true;
+    }
+    return cur->dimension == dim;
+}
+
+void FaceGallery::set_compact(bool enabled, int rerank)
+{
+    //int8特征一直都有, 这里只切换查询方式
+    QMutexLocker locker(&writeMutex);
+    std::shared_ptr<Snapshot> next = next_version();
+    next->rerankSize = qMax(1, rerank);
+    next->compactMode = enabled;
+    publish(next);
+    qDebug()<<"特征库int8压缩模式:"<<enabled<<"重排候选数:"<<next->rerankSize;
+}
+
+void FaceGallery::set_index(bool enabled, const HnswIndex::Params &params, int minRows)
+{
+    //建索引期间查询继续用旧版本
+    QMutexLocker locker(&writeMutex);
+    std::shared_ptr<Snapshot> next = next_version();
+    next->indexMinRows = qMax(0, minRows);
+    if(enabled)
+        liveIndex.reset(new HnswIndex(params));
+    else
+        liveIndex.reset();
+    rebuild_index(*next);
+    publish(next);
+    if(enabled)
+        qDebug()<<"HNSW索引 M:"<<params.M<<"efConstruction:"<<params.efConstruction
+                <<"efSearch:"<<params.efSearch<<"启用人数:"<<next->indexMinRows;
+}
+
+void FaceGallery::publish_index(Snapshot &next)
+{
+    next.index = std::make_shared<const HnswIndex>(*liveIndex);
+    next.indexedRows = next.count;
+}
+
+void FaceGallery::rebuild_index(Snapshot &next)
+{
+    if(!liveIndex)
+    {
+        next.index.reset();
+        next.indexedRows = 0;
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    liveIndex->clear();
+    FeatureMath::Rows rows = next.rows();
+    for(int i = 0; i < next.count; i++)
+        liveIndex->insert(i, rows);
+    publish_index(next);
+    if(next.count > 0)
+        qDebug()<<"HNSW索引建立完成, 人数:"<<next.count<<"耗时(ms):"<<timer.elapsed()
+                <<"内存(KB):"<<liveIndex->memory() / 1024;
+}
+
+void FaceGallery::append_row(Snapshot &next, int64_t faceid, const float *features, bool indexRow)
+{
+    Store *st = next.store.get();
+    if(st == nullptr || next.count >= st->capacity)
+    {
+        //容量不够换一块新的存储, 旧版本继续用旧的, 按1.5倍扩容
+        int mapped = next.mapped_rows();
+        int tail = next.count - mapped;
+        std::shared_ptr<Store> grown(new Store(mapped + qMax(64, tail + tail / 2), mapped, next.stride));
+        if(st != nullptr)
+        {
+            memcpy(grown->ids, st->ids, (size_t)next.count * sizeof(int64_t));
+            memcpy(grown->scales, st->scales, (size_t)next.count * sizeof(float));
+            memcpy(grown->matrix, st->matrix, (size_t)tail * next.stride * sizeof(float));
+            memcpy(grown->codes, st->codes, (size_t)tail * next.stride);
+            for(int i = 0; i < next.count; i++)
+                grown->deleted[i].store(st->deleted[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        next.store = grown;
+        st = grown.get();
+    }
+
+    //写在已发布的行之后, 旧版本看不到这一行
+    int i = next.count;
+    qint64 t = i - st->mappedRows;
+    float *dst = st->matrix + t * next.stride;
+    memcpy(dst, features, next.dimension * sizeof(float));
+    memset(dst + next.dimension, 0, (next.stride - next.dimension) * sizeof(float));
+    st->scales[i] = FeatureMath::quantize(dst, next.dimension, next.stride, st->codes + t * next.stride);
+    st->ids[i] = faceid;
+    next.count++;
+    liveRows.insert(faceid, i);
+
+    if(liveIndex && indexRow)
+    {
+        liveIndex->insert(i, next.rows());
+        if(next.count - next.indexedRows >= IndexPublishRows)
+            publish_index(next);
+    }
+}
+
+//只记下删除时的版本号, 行本身不动, 还在用旧版本的查询照常能查到
+bool FaceGallery::kill_row(Snapshot &next, int64_t faceid)
+{
+    QHash<int64_t, int>::iterator it = liveRows.find(faceid);
+    if(it == liveRows.end()) return false;
+    next.store->deleted[it.value()].store(next.version, std::memory_order_relaxed);
+    next.deadRows++;
+    liveRows.erase(it);
+    return true;
+}
+
+bool FaceGallery::load(const QString &path)
+{
+    QFile file(path);
+    if(!file.open(QIODevice::ReadOnly))
+    {
+        qDebug()<<"特征库不存在:"<<path;
+        return false;
+    }
+
+    //版本2按本机字节序保存, 版本1是QDataStream的大端
+    quint32 magic = 0;
+    file.peek(reinterpret_cast<char *>(&magic), sizeof(magic));
+    if(magic != GalleryMagic)
+        return load_stream(file);
+    file.close();
+
+    QElapsedTimer timer;
+    timer.start();
+    QMutexLocker locker(&writeMutex);
+    if(!map_file(path, false))
+        return false;
+    qDebug()<<"映射特征库"<<path<<"人数:"<<size()<<"耗时(ms):"<<timer.elapsed()<<"指令集:"<<FeatureMath::isa();
+    return true;
+}
+
+//旧格式, 读进内存, 下次保存时转成新格式
+bool FaceGallery::load_stream(QFile &file)
+{
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_14);
+    stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+
+    quint32 magic = 0, version = 0, dim = 0, count = 0;
+    qint64 next = 0;
+    stream>>magic>>version>>dim>>count>>next;
+    if(magic != GalleryMagic || version != StreamVersion)
+    {
+        qDebug()<<"特征库格式错误:"<<file.fileName();
+        return false;
+    }
+    int modelDim = this->dim();
+    if(modelDim != 0 && (int)dim != modelDim)
+    {
+        qDebug()<<"特征库维度"<<dim<<"和模型"<<modelDim<<"不一致";
+        return false;
+    }
+
+    QVector<int64_t> newIds(count);
+    std::vector<float> values((size_t)count * dim);
+    for(quint32 i = 0; i < count; i++)
+    {
+        qint64 id = 0;
+        stream>>id;
+        newIds[i] = id;
+        float *f = values.data() + (size_t)i * dim;
+        for(quint32 k = 0; k < dim; k++)
+            stream>>f[k];
+    }
+    if(stream.status() != QDataStream::Ok)
+    {
+        qDebug()<<"特征库数据不完整:"<<file.fileName();
+        return false;
+    }
+
+    QMutexLocker locker(&writeMutex);
+    std::shared_ptr<Snapshot> snapshot = next_version();
+    clear_rows(*snapshot, dim);
+    snapshot->nextId = next;
+    for(quint32 i = 0; i < count; i++)
+        append_row(*snapshot, newIds[i], values.data() + (size_t)i * dim, false);
+    rebuild_index(*snapshot);
+    publish(snapshot);
+    mappedPath.clear();
+
+    qDebug()<<"导入旧格式特征库"<<file.fileName()<<"人数:"<<count<<"指令集:"<<FeatureMath::isa();
+    return true;
+}
+
+//映射版本2的文件, 发布新版本
+//keepTail: 文件是刚保存的当前数据, 写文件之后新增的行留在内存里, 索引不变; 否则整个替换
+bool FaceGallery::map_file(const QString &path, bool keepTail)
+{
+    SnapshotPtr cur = pin();
+    QFile *file = new QFile(path);
+    GalleryHeader h;
+    if(!file->open(QIODevice::ReadOnly)
+       || file->read(reinterpret_cast<char *>(&h), sizeof(h)) != sizeof(h)
+       || h.magic != GalleryMagic || h.version != MappedVersion)
+    {
+        qDebug()<<"特征库格式错误:"<<path;
+        delete file;
+        return false;
+    }
+    if((cur->dimension != 0 && (int)h.dim != cur->dimension) || (int)h.stride != FeatureMath::padded(h.dim)
+       || h.count > (quint64)INT_MAX / 2 || !valid_layout(h, file->size()))
+    {
+        qDebug()<<"特征库文件头错误:"<<path<<"维度:"<<h.dim<<"模型维度:"<<cur->dimension;
+        delete file;
+        return false;
+    }
+
+    //只读共享映射, 多个进程映射同一个文件时共用页缓存
+    std::shared_ptr<MappedFile> mapped(new MappedFile(file));
+    mapped->base = file->map(0, file->size());
+    if(mapped->base == nullptr)
+    {
+        qDebug()<<"特征库映射失败:"<<file->errorString();
+        return false;
+    }
+    const uchar *base = mapped->base;
+
+    int count = (int)h.count;
+    int keep = keepTail ? qMax(0, cur->count - count) : 0;
+    std::shared_ptr<Store> st(new Store(count + qMax(64, keep), count, h.stride));
+
+    //faceID和缩放系数很小, 复制出来方便追加
+    memcpy(st->ids, base + h.idsOffset, (size_t)count * sizeof(int64_t));
+    memcpy(st->scales, base + h.scalesOffset, (size_t)count * sizeof(float));
+    //文件之后新增的行搬到新的存储
+    for(int i = 0; i < keep; i++)
+    {
+        memcpy(st->matrix + (qint64)i * h.stride, cur->row(count + i), h.stride * sizeof(float));
+        memcpy(st->codes + (qint64)i * h.stride, cur->code(count + i), h.stride);
+        st->ids[count + i] = cur->store->ids[count + i];
+        st->scales[count + i] = cur->store->scales[count + i];
+    }
+
+    std::shared_ptr<Snapshot> next = next_version();
+    if(keepTail)
+    {
+        //行号不变, 墓碑(包括写文件之后才删除的)照搬
+        for(int i = 0; i < count + keep; i++)
+            st->deleted[i].store(cur->store->deleted[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    else
+    {
+        //文件里faceID为-1的行是保存时已经删除的
+        next->deadRows = 0;
+        next->generation++;
+        liveRows.clear();
+        for(int i = 0; i < count; i++)
+        {
+            if(st->ids[i] < 0)
+            {
+                st->deleted[i].store(next->version, std::memory_order_relaxed);
+                next->deadRows++;
+            }
+            else
+                liveRows.insert(st->ids[i], i);
+        }
+    }
+    next->dimension = h.dim;
+    next->stride = h.stride;
+    next->count = count + keep;
+    next->nextId = keepTail ? qMax<int64_t>(cur->nextId, h.nextId) : h.nextId;
+    next->file = mapped;
+    next->mappedMatrix = reinterpret_cast<const float *>(base + h.rowsOffset);
+    next->mappedCodes = reinterpret_cast<const int8_t *>(base + h.codesOffset);
+    next->store = st;
+    if(!keepTail)
+        rebuild_index(*next);
+    publish(next);
+    mappedPath = QFileInfo(path).absoluteFilePath();
+    return true;
+}
+
+//把映射的行复制到内存, 等还在用旧版本的查询结束后文件才真正取消映射
+//返回旧的映射, 调用者释放写锁后再等它失效
+std::weak_ptr<FaceGallery::MappedFile> FaceGallery::detach_mapping()
+{
+    SnapshotPtr cur = pin();
+    if(!cur->file)
+    {
+        mappedPath.clear();
+        return std::weak_ptr<MappedFile>();
+    }
+
+    std::shared_ptr<Store> st(new Store(cur->count + 64, 0, cur->stride));
+    for(int i = 0; i < cur->count; i++)
+    {
+        memcpy(st->matrix + (qint64)i * cur->stride, cur->row(i), cur->stride * sizeof(float));
+        memcpy(st->codes + (qint64)i * cur->stride, cur->code(i), cur->stride);
+    }
+    memcpy(st->ids, cur->store->ids, (size_t)cur->count * sizeof(int64_t));
+    memcpy(st->scales, cur->store->scales, (size_t)cur->count * sizeof(float));
+    for(int i = 0; i < cur->count; i++)
+        st->deleted[i].store(cur->store->deleted[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+    std::shared_ptr<Snapshot> next = next_version();
+    next->file.reset();
+    next->mappedMatrix = nullptr;
+    next->mappedCodes = nullptr;
+    next->store = st;
+    publish(next);
+    mappedPath.clear();
+    return cur->file;
+}
+
+bool FaceGallery::save(const QString &path)
+{
+    //先写临时文件, 完成后替换, 其他进程已经映射的旧文件不受影响
+    QSaveFile file(path);
+    if(!file.open(QIODevice::WriteOnly))
+    {
+        qDebug()<<"特征库保存失败:"<<file.errorString();
+        return false;
+    }
+
+    //写的是当前版本, 写文件期间注册和查询都不受影响
+    SnapshotPtr s = pin();
+    int generation = s->generation;
+    GalleryHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = GalleryMagic;
+    h.version = MappedVersion;
+    h.dim = s->dimension;
+    h.stride = s->stride;
+    h.count = s->count;
+    h.nextId = s->nextId;
+    layout(h);
+
+    //已删除的行faceID写成-1, 行号保持不变
+    QVector<int64_t> savedIds(s->count);
+    for(int i = 0; i < s->count; i++)
+        savedIds[i] = s->dead(i) ? -1 : s->store->ids[i];
+    const char *ids = reinterpret_cast<const char *>(savedIds.constData());
+    const char *scales = s->store ? reinterpret_cast<const char *>(s->store->scales) : nullptr;
+    bool ok = file.write(reinterpret_cast<const char *>(&h), sizeof(h)) == sizeof(h)
+           && pad_to(file, h.idsOffset)
+           && file.write(ids, h.count * sizeof(int64_t)) == qint64(h.count * sizeof(int64_t))
+           && pad_to(file, h.scalesOffset)
+           && file.write(scales, h.count * sizeof(float)) == qint64(h.count * sizeof(float))
+           && pad_to(file, h.codesOffset);
+    for(int i = 0; ok && i < s->count; i++)
+        ok = file.write(reinterpret_cast<const char *>(s->code(i)), s->stride) == s->stride;
+    ok = ok && pad_to(file, h.rowsOffset);
+    for(int i = 0; ok && i < s->count; i++)
+        ok = file.write(reinterpret_cast<const char *>(s->row(i)), s->stride * sizeof(float)) == qint64(s->stride * sizeof(float));
+    s.reset();
+    if(!ok)
+    {
+        qDebug()<<"特征库写入失败:"<<file.errorString();
+        file.cancelWriting();
+        return false;
+    }
+
+    QMutexLocker locker(&writeMutex);
+#ifdef Q_OS_WIN
+    //Windows 不能替换正在映射的文件, 先把映射的行复制到内存
+    //等旧映射释放时不能拿着写锁: 清理(purge)拿着旧版本在等写锁; 等完再检查一次, 期间可能又映射了这个文件
+    while(mappedPath == QFileInfo(path).absoluteFilePath())
+    {
+        std::weak_ptr<MappedFile> old = detach_mapping();
+        locker.unlock();
+        while(!old.expired())
+            QThread::msleep(1);
+        locker.relock();
+    }
+#endif
+    if(!file.commit())
+    {
+        qDebug()<<"特征库保存失败:"<<file.errorString();
+        return false;
+    }
+
+    //改为映射刚写好的文件, 释放内存里的特征; 写文件期间行号重排过就等下次保存
+    if(pin()->generation != generation)
+        qDebug()<<"特征库已保存, 期间行号有变化, 暂不重新映射";
+    else if(!map_file(path, true))
+        qDebug()<<"特征库已保存, 重新映射失败, 继续使用内存里的数据";
+    return true;
+}
+
+bool FaceGallery::open_journal(const QString &path, int syncMs, int syncBatch, int compactRecords)
+{
+    close_journal();
+
+    //合并时崩溃会留下封存的日志, 先重放它再重放当前日志
+    GalleryJournal *j = new GalleryJournal(path + ".journal");
+    int replayed = replay(j->sealed_path()) + replay(j->path());
+    if(!j->open())
+    {
+        delete j;
+        return false;
+    }
+
+    {
+        QMutexLocker locker(&writeMutex);
+        journal = j;
+        journalGallery = path;
+        journalBatch = qMax(1, syncBatch);
+    }
+    if(syncMs > 0 || compactRecords > 0)
+    {
+        journalWorker = new JournalWorker(this, syncMs > 0 ? syncMs : 1000, compactRecords);
+        journalWorker->start();
+    }
+    qDebug()<<"打开注册日志"<<j->path()<<"重放记录:"<<replayed<<"fsync间隔(ms):"<<syncMs<<"合并条数:"<<compactRecords;
+    return true;
+}
+
+void FaceGallery::close_journal()
+{
+    if(journalWorker)
+    {
+        journalWorker->stop();
+        delete journalWorker;
+        journalWorker = nullptr;
+    }
+
+    QMutexLocker locker(&writeMutex);
+    delete journal; //关闭前会fsync
+    journal = nullptr;
+}
+
+//只在日志线程里调用, 日志线程停止之后才会关闭日志
+bool FaceGallery::sync_journal()
+{
+    return journal == nullptr || journal->sync();
+}
+
+int FaceGallery::journal_records() const
+{
+    return journal ? journal->records() : 0;
+}
+
+int FaceGallery::replay(const QString &path, bool skipApplied)
+{
+    QVector<GalleryJournal::Record> records = GalleryJournal::read(path);
+    if(skipApplied && journal)
+        journal->drop_applied(records);
+    if(records.isEmpty()) return 0;
+
+    QMutexLocker locker(&writeMutex);
+    std::shared_ptr<Snapshot> next = next_version();
+    int applied = 0;
+    for(const GalleryJournal::Record &r : records)
+    {
+        if(r.op == GalleryJournal::Remove)
+        {
+            if(kill_row(*next, r.faceid)) applied++;
+            continue;
+        }
+        bool add = r.op == GalleryJournal::Add && !liveRows.contains(r.faceid);
+        bool update = r.op == GalleryJournal::Update;
+        if(!(add || update) || r.features.size() != next->dimension)
+            continue;
+        kill_row(*next, r.faceid);
+        append_row(*next, r.faceid, r.features.constData());
+        next->nextId = qMax(next->nextId, r.faceid + 1);
+        applied++;
+    }
+    if(applied > 0)
+        publish(next);
+    if(applied > 0 && listener)
+    {
+        //按最终结果通知: 同一个faceID的多条记录只看最后的状态
+        QSet<int64_t> touched;
+        for(const GalleryJournal::Record &r : records)
+            touched.insert(r.faceid);
+        for(int64_t faceid : touched)
+        {
+            int row = liveRows.value(faceid, -1);
+            if(row >= 0)
+                listener->row_changed(faceid, next->row(row));
+            else
+                listener->row_removed(faceid);
+        }
+    }
+    return applied;
+}
+
+bool FaceGallery::compact_journal()
+{
+    QMutexLocker guard(&compactMutex);
+    if(journal == nullptr) return false;
+
+    QElapsedTimer timer;
+    timer.start();
+    int records = journal_records();
+    if(!journal->seal()) return false;
+    //注册窗口等其他进程直接写进日志的记录也合并进来; 本进程的记录已经在特征库里, 再用一次
+    //会让每次更新多出一个墓碑和重复的行, 封存之后才删除的人也会被封存日志里的添加记录加回来
+    replay(journal->sealed_path(), true);
+    if(!save(journalGallery))
+    {
+        //封存的日志留着, 下次启动时重放
+        return false;
+    }
+    journal->remove_sealed();
+    qDebug()<<"日志合并完成, 记录数:"<<records<<"人数:"<<size()<<"耗时(ms):"<<timer.elapsed();
+    return true;
+}
+
+//调用时已持有 writeMutex
+void FaceGallery::journal_write(int op, int64_t faceid, const float *features, int dim)
+{
+    if(journal == nullptr) return;
+    journal->append(GalleryJournal::Op(op), faceid, features, dim);
+    if(journalWorker == nullptr)
+        journal->sync();
+    else if(journal->unsynced() >= journalBatch)
+        journalWorker->wake();
+}
+
+int64_t FaceGallery::add(const float *f)
+{
+    QMutexLocker locker(&writeMutex);
+    std::shared_ptr<Snapshot> next = next_version();
+    int64_t faceid = next->nextId++;
+    append_row(*next, faceid, f);
+    journal_write(GalleryJournal::Add, faceid, f, next->dimension);
+    publish(next);
+    if(listener) listener->row_changed(faceid, f);
+    return faceid;
+}
+
+void FaceGallery::add(int64_t faceid, const float *f)
+{
+    bool inlinePurge = false;
+    {
+        QMutexLocker locker(&writeMutex);
+        std::shared_ptr<Snapshot> next = next_version();
+        //faceID已经存在时按更新处理, 不留重复的行
+        bool exists = kill_row(*next, faceid);
+        append_row(*next, faceid, f);
+        next->nextId = qMax(next->nextId, faceid + 1);
+        journal_write(exists ? GalleryJournal::Update : GalleryJournal::Add, faceid, f, next->dimension);
+        publish(next);
+        if(listener) listener->row_changed(faceid, f);
+        inlinePurge = exists && schedule_purge(*next);
+    }
+    if(inlinePurge) purge();
+}
+
+bool FaceGallery::remove(int64_t faceid)
+{
+    bool inlinePurge = false;
+    {
+        QMutexLocker locker(&writeMutex);
+        std::shared_ptr<Snapshot> next = next_version();
+        if(!kill_row(*next, faceid)) return false;
+        journal_write(GalleryJournal::Remove, faceid, nullptr, 0);
+        publish(next);
+        if(listener) listener->row_removed(faceid);
+        inlinePurge = schedule_purge(*next);
+    }
+    //没有后台线程时直接清理
+    if(inlinePurge) purge();
+    return true;
+}
+
+bool FaceGallery::update(int64_t faceid, const float *f)
+{
+    bool inlinePurge = false;
+    {
+        //删除旧行和追加新行在同一个版本里发布, 查询不会看到中间状态
+        QMutexLocker locker(&writeMutex);
+        std::shared_ptr<Snapshot> next = next_version();
+        if(!kill_row(*next, faceid)) return false;
+        append_row(*next, faceid, f);
+        journal_write(GalleryJournal::Update, faceid, f, next->dimension);
+        publish(next);
+        if(listener) listener->row_changed(faceid, f);
+        //旧行留下的空位和删除一样需要清理
+        inlinePurge = schedule_purge(*next);
+    }
+    if(inlinePurge) purge();
+    return true;
+}
+
+void FaceGallery::set_purge(double ratio)
+{
+    QMutexLocker locker(&writeMutex);
+    purgeRatio = qMax(0.0, ratio);
+}
+
+bool FaceGallery::purge_due(const Snapshot &s) const
+{
+    return purgeRatio > 0 && s.deadRows > 0 && s.deadRows >= purgeRatio * s.count;
+}
+
+bool FaceGallery::schedule_purge(const Snapshot &s)
+{
+    if(!purge_due(s)) return false;
+    if(journalWorker)
+    {
+        journalWorker->wake();
+        return false;
+    }
+    return true;
+}
+
+bool FaceGallery::purge()
+{
+    QMutexLocker guard(&purgeMutex);
+    SnapshotPtr base = pin();
+    if(base->deadRows == 0) return true;
+
+    QElapsedTimer timer;
+    timer.start();
+    HnswIndex::Params params;
+    bool indexing = false;
+    {
+        QMutexLocker locker(&writeMutex);
+        indexing = liveIndex != nullptr;
+        if(indexing) params = liveIndex->params();
+    }
+
+    //先不加锁按base复制有效的行并建索引, 期间注册和删除照常进行
+    int live = base->count - base->deadRows;
+    int stride = base->stride;
+    std::shared_ptr<Store> st(new Store(live + qMax(64, live / 2), 0, stride));
+    std::vector<int> moved(base->count, -1);
+    int rows = 0;
+    for(int i = 0; i < base->count; i++)
+    {
+        if(base->dead(i)) continue;
+        memcpy(st->matrix + (qint64)rows * stride, base->row(i), stride * sizeof(float));
+        memcpy(st->codes + (qint64)rows * stride, base->code(i), stride);
+        st->ids[rows] = base->store->ids[i];
+        st->scales[rows] = base->store->scales[i];
+        moved[i] = rows++;
+    }
+    std::unique_ptr<HnswIndex> index;
+    if(indexing)
+    {
+        index.reset(new HnswIndex(params));
+        FeatureMath::Rows data = { nullptr, st->matrix, 0, stride };
+        for(int i = 0; i < rows; i++)
+            index->insert(i, data);
+    }
+
+    //再加锁补上期间的修改
+    QMutexLocker locker(&writeMutex);
+    SnapshotPtr cur = pin();
+    if(cur->generation != base->generation || indexing != (liveIndex != nullptr))
+    {
+        qDebug()<<"清理期间特征库被重新导入或索引设置有变化, 下次再清理";
+        return false;
+    }
+
+    std::shared_ptr<Snapshot> next = next_version();
+    int dead = 0;
+    for(int i = 0; i < base->count; i++)
+    {
+        if(moved[i] >= 0 && next->dead(i))
+        {
+            st->deleted[moved[i]].store(next->version, std::memory_order_relaxed);
+            dead++;
+        }
+    }
+
+    next->generation++;
+    next->file.reset();
+    next->mappedMatrix = nullptr;
+    next->mappedCodes = nullptr;
+    next->store = st;
+    next->count = rows;
+    next->deadRows = dead;
+    liveIndex = std::move(index);
+    liveRows.clear();
+    for(int i = 0; i < rows; i++)
+    {
+        if(!next->dead(i)) liveRows.insert(st->ids[i], i);
+    }
+    if(liveIndex)
+        publish_index(*next);
+    else
+        next->index.reset();
+
+    //base之后新增的行
+    for(int i = base->count; i < cur->count; i++)
+    {
+        if(!cur->dead(i))
+            append_row(*next, cur->store->ids[i], cur->row(i));
+    }
+    publish(next);
+    mappedPath.clear();
+
+    qDebug()<<"清理已删除的行:"<<base->count - rows<<"人数:"<<next->count - next->deadRows
+            <<"耗时(ms):"<<timer.elapsed();
+    return true;
+}
+
+int FaceGallery::tombstones() const
+{
+    return pin()->deadRows;
+}
+
+int64_t FaceGallery::search(const float *f, float *similarity) const
+{
+    int64_t best = -1;
+    float bestScore = 0;
+    search(f, 1, &best, &bestScore);
+    if(similarity) *similarity = bestScore;
+    return best;
+}
+
+int FaceGallery::search(const float *f, int k, int64_t *outIds, float *outScores) const
+{
+    if(k <= 0) return 0;
+
+    SnapshotPtr s = pin();
+    if(s->count == 0) return 0;
+
+    AlignedQuery query(f, s->dimension, s->stride);
+    if(s->index && s->count >= s->indexMinRows)
+        return search_index(*s, query.data, k, outIds, outScores);
+    //人数比候选数还少时直接全部用浮点算
+    if(s->compactMode && s->count > qMax(k, s->rerankSize))
+        return search_compact(*s, query.data, k, outIds, outScores);
+    return search_float(*s, query.data, k, outIds, outScores);
+}
+
+void FaceGallery::search_batch(const float *f, int n, int64_t *outIds, float *outScores) const
+{
+    for(int q = 0; q < n; q++)
+    {
+        outIds[q] = -1;
+        outScores[q] = 0;
+    }
+    SnapshotPtr s = pin();
+    if(n <= 0 || s->count == 0) return;
+
+    //所有查询补齐后连续存放
+    int stride = s->stride;
+    float *queries = static_cast<float *>(qMallocAligned((size_t)n * stride * sizeof(float), FeatureMath::Alignment));
+    for(int q = 0; q < n; q++)
+    {
+        float *dst = queries + (qint64)q * stride;
+        memcpy(dst, f + (qint64)q * s->dimension, s->dimension * sizeof(float));
+        memset(dst + s->dimension, 0, (stride - s->dimension) * sizeof(float));
+    }
+
+    //索引和int8模式本来就只读一小部分数据, 逐个查
+    if(s->index && s->count >= s->indexMinRows)
+    {
+        for(int q = 0; q < n; q++)
+            search_index(*s, queries + (qint64)q * stride, 1, outIds + q, outScores + q);
+    }
+    else if(s->compactMode && s->count > s->rerankSize)
+    {
+        for(int q = 0; q < n; q++)
+            search_compact(*s, queries + (qint64)q * stride, 1, outIds + q, outScores + q);
+    }
+    else
+    {
+        scan_batch(*s, queries, n, outIds, outScores);
+    }
+    qFreeAligned(queries);
+}
+
+//queries已经补齐对齐, 每个查询取最相似的一个
+void FaceGallery::scan_batch(const Snapshot &s, const float *queries, int n, int64_t *outIds, float *outScores)
+{
+    float scores[BatchRows];
+    std::vector<int> found(n, 0);
+
+    for(int start = 0; start < s.count; )
+    {
+        int rows = qMin(BatchRows, block_rows(start, s.count, s.mapped_rows()));
+        const float *block = s.row(start);
+        for(int q = 0; q < n; q++)
+        {
+            FeatureMath::dot_rows(queries + (qint64)q * s.stride, block, rows, s.stride, scores);
+            for(int i = 0; i < rows; i++)
+            {
+                if(s.deadRows > 0 && s.dead(start + i)) continue;
+                push_topk(s.store->ids[start + i], scores[i], 1, found[q], outIds + q, outScores + q);
+            }
+        }
+        start += rows;
+    }
+}
+
+//从第from行开始逐行比较, 结果合并进已有的前k名
+void FaceGallery::scan(const Snapshot &s, const float *query, int from, int k, int &found, int64_t *outIds, float *outScores)
+{
+    float scores[ScoreBlock];
+
+    //分块算相似度, 每块里把比当前第k名高的插入到有序结果中
+    for(int start = from; start < s.count; )
+    {
+        int n = block_rows(start, s.count, s.mapped_rows());
+        FeatureMath::dot_rows(query, s.row(start), n, s.stride, scores);
+        for(int i = 0; i < n; i++)
+        {
+            if(s.deadRows > 0 && s.dead(start + i)) continue;
+            push_topk(s.store->ids[start + i], scores[i], k, found, outIds, outScores);
+        }
+        start += n;
+    }
+}
+
+//query已经补齐对齐
+int FaceGallery::search_float(const Snapshot &s, const float *query, int k, int64_t *outIds, float *outScores)
+{
+    int found = 0;
+    scan(s, query, 0, k, found, outIds, outScores);
+    return found;
+}
+
+//query已经补齐对齐
+int FaceGallery::search_compact(const Snapshot &s, const float *query, int k, int64_t *outIds, float *outScores)
+{
+    //查询特征也量化成int8
+    int8_t *qcode = static_cast<int8_t *>(qMallocAligned(s.stride, FeatureMath::Alignment));
+    float qscale = FeatureMath::quantize(query, s.dimension, s.stride, qcode);
+
+    //第一遍: int8 近似相似度选出候选行
+    int shortlist = qMax(k, s.rerankSize);
+    std::vector<int> candRows(shortlist);
+    std::vector<float> candScores(shortlist);
+    int candidates = 0;
+    int32_t dots[ScoreBlock];
+    for(int start = 0; start < s.count; )
+    {
+        int n = block_rows(start, s.count, s.mapped_rows());
+        FeatureMath::dot_rows_i8(qcode, s.code(start), n, s.stride, dots);
+        for(int i = 0; i < n; i++)
+        {
+            if(s.deadRows > 0 && s.dead(start + i)) continue;
+            float approx = dots[i] * qscale * s.store->scales[start + i];
+            push_topk(start + i, approx, shortlist, candidates, candRows.data(), candScores.data());
+        }
+        start += n;
+    }
+    qFreeAligned(qcode);
+
+    //第二遍: 候选用浮点特征重新计算
+    int found = 0;
+    for(int c = 0; c < candidates; c++)
+    {
+        int r = candRows[c];
+        push_topk(s.store->ids[r], FeatureMath::dot(query, s.row(r), s.stride), k, found, outIds, outScores);
+    }
+    return found;
+}
+
+//query已经补齐对齐
+int FaceGallery::search_index(const Snapshot &s, const float *query, int k, int64_t *outIds, float *outScores, int ef)
+{
+    //有墓碑时取整个候选列表, 去掉已删除的
+    int want = k;
+    if(s.deadRows > 0)
+        want = qMax(k, ef > 0 ? ef : s.index->params().efSearch);
+    std::vector<int> hits(want);
+    std::vector<float> hitScores(want);
+    int n = s.index->search(query, s.rows(), want, hits.data(), hitScores.data(), ef);
+    int found = 0;
+    for(int i = 0; i < n && found < k; i++)
+    {
+        if(s.deadRows > 0 && s.dead(hits[i])) continue;
+        outIds[found] = s.store->ids[hits[i]];
+        outScores[found] = hitScores[i];
+        found++;
+    }
+    //索引发布之后新增的行
+    scan(s, query, s.indexedRows, k, found, outIds, outScores);
+    return found;
+}
+
+double FaceGallery::measure_recall(int samples, int k, int ef, double *exactUs, double *indexUs) const
+{
+    SnapshotPtr s = pin();
+    int live = s->count - s->deadRows;
+    if(!s->index || live == 0 || samples <= 0 || k <= 0) return 0;
+
+    k = qMin(k, live);
+    samples = qMin(samples, s->count);
+    std::vector<int64_t> exactIds(k), approxIds(k);
+    std::vector<float> exactScores(k), approxScores(k);
+    qint64 exactNs = 0, indexNs = 0;
+    int hits = 0;
+    QElapsedTimer timer;
+
+    //库里的特征均匀抽样作为查询
+    for(int i = 0; i < samples; i++)
+    {
+        const float *query = s->row((qint64)i * s->count / samples);
+
+        timer.start();
+        int exact = search_float(*s, query, k, exactIds.data(), exactScores.data());
+        exactNs += timer.nsecsElapsed();
+
+        timer.start();
+        int approx = search_index(*s, query, k, approxIds.data(), approxScores.data(), ef);
+        indexNs += timer.nsecsElapsed();
+
+        for(int j = 0; j < approx; j++)
+        {
+            if(std::find(exactIds.begin(), exactIds.begin() + exact, approxIds[j]) != exactIds.begin() + exact)
+                hits++;
+        }
+    }
+
+    if(exactUs) *exactUs = exactNs / 1000.0 / samples;
+    if(indexUs) *indexUs = indexNs / 1000.0 / samples;
+    return double(hits) / (double(samples) * k);
+}
+
+bool FaceGallery::compact() const
+{
+    return pin()->compactMode;
+}
+
+bool FaceGallery::indexed() const
+{
+    return pin()->index != nullptr;
+}
+
+int FaceGallery::copy_to(FaceGallery &target, const QSet<int64_t> &ids) const
+{
+    SnapshotPtr s = pin();
+    if(s->dimension == 0 || !target.init(s->dimension)) return 0;
+
+    int copied = 0;
+    for(int i = 0; i < s->count; i++)
+    {
+        if(s->dead(i) || !ids.contains(s->store->ids[i])) continue;
+        target.add(s->store->ids[i], s->row(i));
+        copied++;
+    }
+    return copied;
+}
+
+void FaceGallery::set_listener(Listener *l)
+{
+    QMutexLocker locker(&writeMutex);
+    listener = l;
+}
+
+int FaceGallery::size() const
+{
+    SnapshotPtr s = pin();
+    return s->count - s->deadRows;
+}
+
+int FaceGallery::dim() const
+{
+    return pin()->dimension;
+}
+
+quint64 FaceGallery::version() const
+{
+    return pin()->version;
+}
@@ -0,0 +1,234 @@
+﻿#ifndef FACEGALLERY_H
+#define FACEGALLERY_H
+
+#include <QString>
+#include <QVector>
+#include <QMutex>
+#include <QHash>
+#include <QSet>
+#include <memory>
+#include <atomic>
+#include "featuremath.h"
+#include "hnswindex.h"
+
+class QFile;
+class GalleryJournal;
+class JournalWorker;
+
+//人脸特征库: 保存每个faceID对应的特征(已归一化), 查询时返回最相似的faceID
+//所有特征按行连续存放并对齐, 每行补齐到 FeatureMath::Lanes 的整数倍,
+//查询就是按顺序扫一遍矩阵, 用SIMD求点积
+//特征库文件按内存布局保存, 导入时直接映射到内存(只复制faceID和缩放系数), 用到哪页才读哪页,
+//多个进程映射同一个文件时共用一份物理内存; 导入后新增的特征放在进程自己的内存里, 保存后再重新映射
+//每行另外保存int8量化特征和缩放系数, int8压缩模式下先扫int8矩阵(数据量是浮点的1/4)选出候选,
+//再只对候选用浮点特征重新计算相似度
+//人数很多时可以打开HNSW近似索引, 查询只访问图上的少量节点, 注册时增量插入
+//打开日志后注册只追加日志记录, 日志在后台合并进特征库文件, 启动时重放没合并的日志
+//
+//多个识别线程共用一个特征库, 查询不加锁: 每次查询先原子地取得当前版本(Snapshot), 版本内容不会再改变;
+//注册等修改在写锁里生成下一个版本, 再原子地替换当前版本, 旧版本在最后一个查询用完后释放
+//新增的行写在已发布的行之后, 新旧版本共用同一块存储, 注册一次只需要生成一个很小的版本对象
+//删除只记下删除时的版本号(墓碑), 之后的版本查询时跳过这一行; 更新是删除旧行再追加新行
+//墓碑占到一定比例后在后台重新生成紧凑的特征矩阵和索引
+
+class FaceGallery
+{
+public:
+    //fr_2_10 的特征库, 其他识别模型的特征库文件名见 ServerConfig::galleryPath
+    static const char *DefaultPath;
+
+    //特征库修改(添加, 删除, 更新, 重放其他进程的日志)后的通知, 用来同步从这个特征库派生的特征库(分区)
+    //在写锁里调用, 不能再修改这个特征库; 导入(load)和清理不改变内容, 不通知
+    class Listener
+    {
+    public:
+        virtual ~Listener() {}
+        //添加faceID或者替换它的特征
+        virtual void row_changed(int64_t faceid, const float *features) = 0;
+        virtual void row_removed(int64_t faceid) = 0;
+    };
+
+    explicit FaceGallery(int dim = 0);
+    ~FaceGallery();
+
+    //空库还没有确定维度时设置维度, 维度已经不同返回false
+    bool init(int dim);
+
+    bool load(const QString &path);
+    //保存后改为映射新文件, 内存里的特征随之释放
+    bool save(const QString &path);
+
+    //打开注册日志: 先重放上次没合并的日志, 之后每次添加都追加到日志, 合并时保存到path
+    //syncMs: 后台fsync间隔, 0表示每条记录立即fsync; syncBatch: 攒够这么多条立即fsync
+    //compactRecords: 日志达到这么多条时在后台合并进特征库文件, 0表示不自动合并
+    bool open_journal(const QString &path, int syncMs = 100, int syncBatch = 32, int compactRecords = 0);
+    void close_journal();
+    bool journaled() const { return journal != nullptr; }
+    //把日志(包括其他进程写入的记录)合并进特征库文件, 然后清空日志
+    bool compact_journal();
+
+    //添加一个特征, 返回新分配的faceID
+    int64_t add(const float *features);
+    //按指定的faceID添加(导入旧数据时用)
+    void add(int64_t faceid, const float *features);
+    //删除faceID, 不存在返回false
+    bool remove(int64_t faceid);
+    //替换faceID的特征, 不存在返回false
+    bool update(int64_t faceid, const float *features);
+
+    //查找最相似的特征, 库为空返回-1
+    int64_t search(const float *features, float *similarity) const;
+    //查找最相似的k个, 按相似度从高到低写入ids/scores, 返回实际个数
+    int search(const float *features, int k, int64_t *ids, float *scores) const;
+    //批量查找n个连续存放的特征, 每个只取最相似的一个, 库为空时id为-1
+    //每读一小块矩阵就把所有查询都算完, 矩阵只从内存读一遍
+    void search_batch(const float *features, int n, int64_t *ids, float *scores) const;
+
+    //把ids中有效的行复制到另一个特征库(生成分区用), 返回复制的行数
+    int copy_to(FaceGallery &target, const QSet<int64_t> &ids) const;
+    //只能有一个, 为空时取消
+    void set_listener(Listener *listener);
+
+    //打开/关闭int8压缩模式, rerank为浮点重排的候选数
+    void set_compact(bool enabled, int rerank = 16);
+    bool compact() const;
+
+    //打开/关闭HNSW索引, 人数达到minRows后查询才走索引, 打开时对已有特征建索引
+    void set_index(bool enabled, const HnswIndex::Params &params = HnswIndex::Params(), int minRows = 0);
+    bool indexed() const;
+    //抽样比较索引和精确查找的结果, 返回前k名的召回率, 可选输出两种方式的平均耗时(微秒)
+    double measure_recall(int samples, int k, int ef = 0, double *exactUs = nullptr, double *indexUs = nullptr) const;
+
+    //墓碑占总行数的比例达到ratio时自动清理, 0表示不自动清理
+    void set_purge(double ratio);
+    //清理墓碑: 只保留有效的行重新生成矩阵和索引, 期间查询和注册照常进行
+    bool purge();
+    //已删除还没清理的行数
+    int tombstones() const;
+
+    //有效人数, 不含已删除的
+    int size() const;
+    int dim() const;
+    //当前版本号, 每次修改加1
+    quint64 version() const;
+
+    //L2归一化, 归一化后相似度就是点积
+    static void normalize(float *features, int dim);
+
+private:
+    Q_DISABLE_COPY(FaceGallery)
+    friend class JournalWorker;
+
+    //映射的特征库文件, 最后一个引用它的版本释放时取消映射
+    struct MappedFile
+    {
+        explicit MappedFile(QFile *file) : file(file), base(nullptr) {}
+        ~MappedFile();
+        QFile *file;
+        const uchar *base;
+    };
+
+    //可以追加的存储: 所有行的faceID和缩放系数, 以及映射之后新增行的特征
+    //已经发布的行不再修改, 追加只写在已发布的行之后, 容量不够时整块换新的
+    struct Store
+    {
+        Store(int capacity, int mappedRows, int stride);
+        ~Store();
+        int capacity;       //总行数容量
+        int mappedRows;     //前面这么多行的特征在映射的文件里
+        int64_t *ids;
+        float *scales;
+        float *matrix;      //第 mappedRows 行开始的特征
+        int8_t *codes;
+        std::atomic<quint64> *deleted;  //删除时的版本号, 0表示没有删除
+    };
+
+    //一个不会再修改的版本, 查询线程拿到后不加锁使用
+    struct Snapshot
+    {
+        quint64 version;
+        int dimension;
+        int stride;
+        int count;          //总行数, 包括已删除的
+        int deadRows;
+        int64_t nextId;
+        int generation;     //行号整体重排(导入/清理)时加1
+        std::shared_ptr<MappedFile> file;
+        const float *mappedMatrix;
+        const int8_t *mappedCodes;
+        std::shared_ptr<Store> store;
+
+        bool compactMode;
+        int rerankSize;
+        //索引只覆盖前 indexedRows 行, 后面的行逐个比较
+        std::shared_ptr<const HnswIndex> index;
+        int indexedRows;
+        int indexMinRows;
+
+        int mapped_rows() const { return store ? store->mappedRows : 0; }
+        FeatureMath::Rows rows() const
+        {
+            return FeatureMath::Rows{ mappedMatrix, store ? store->matrix : nullptr, mapped_rows(), stride };
+        }
+        const float *row(int i) const { return rows()[i]; }
+        const int8_t *code(int i) const
+        {
+            return i < mapped_rows() ? mappedCodes + (qint64)i * stride
+                                     : store->codes + (qint64)(i - mapped_rows()) * stride;
+        }
+        //这个版本发布之后才删除的行仍然有效
+        bool dead(int i) const
+        {
+            quint64 v = store->deleted[i].load(std::memory_order_relaxed);
+            return v != 0 && v <= version;
+        }
+    };
+    typedef std::shared_ptr<const Snapshot> SnapshotPtr;
+
+    //取得当前版本, 查询期间一直有效
+    SnapshotPtr pin() const { return std::atomic_load(&current); }
+
+    bool sync_journal();
+    int journal_records() const;
+    //重放日志文件, 已有的faceID跳过, 返回新增的行数; skipApplied时跳过本进程已经用过的记录
+    int replay(const QString &path, bool skipApplied = false);
+    void journal_write(int op, int64_t faceid, const float *features, int dim);
+
+    //以下调用时已持有 writeMutex
+    std::shared_ptr<Snapshot> next_version() const;
+    void publish(const std::shared_ptr<Snapshot> &next);
+    void append_row(Snapshot &next, int64_t faceid, const float *features, bool indexRow = true);
+    bool kill_row(Snapshot &next, int64_t faceid);
+    bool purge_due(const Snapshot &s) const;
+    //删除的行够多时叫醒后台线程清理, 没有后台线程时返回true, 由调用者放开 writeMutex 后直接 purge
+    bool schedule_purge(const Snapshot &s);
+    void publish_index(Snapshot &next);
+    void rebuild_index(Snapshot &next);
+    void clear_rows(Snapshot &next, int dim);
+    bool map_file(const QString &path, bool keepTail);
+    std::weak_ptr<MappedFile> detach_mapping();
+    bool load_stream(QFile &file);
+
+    static void scan(const Snapshot &s, const float *query, int from, int k, int &found, int64_t *ids, float *scores);
+    static void scan_batch(const Snapshot &s, const float *queries, int n, int64_t *ids, float *scores);
+    static int search_float(const Snapshot &s, const float *query, int k, int64_t *ids, float *scores);
+    static int search_compact(const Snapshot &s, const float *query, int k, int64_t *ids, float *scores);
+    static int search_index(const Snapshot &s, const float *query, int k, int64_t *ids, float *scores, int ef = 0);
+
+    SnapshotPtr current;
+    QMutex writeMutex;          //修改特征库时加锁, 查询不用
+    QString mappedPath;
+    std::unique_ptr<HnswIndex> liveIndex;   //写线程维护的索引, 定期复制一份发布给查询
+    QHash<int64_t, int> liveRows;           //有效faceID所在的行, 只有写线程使用
+    double purgeRatio;
+    Listener *listener;
+    QMutex purgeMutex;          //同一时间只做一次清理
+
+    GalleryJournal *journal;    //为空表示没有日志, 注册后需要调用save
+    JournalWorker *journalWorker;
+    QString journalGallery;     //合并日志时保存的特征库文件
+    int journalBatch;
+    QMutex compactMutex;        //同一时间只做一次合并
+};
+
+#endif // FACEGALLERY_H
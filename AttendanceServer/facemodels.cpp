@@ -0,0 +1,106 @@
+﻿#include "facemodels.h"
+#include "serverconfig.h"
+#include "seetabackend.h"
+#include "dnnbackend.h"
+#include <QMutexLocker>
+#include <QElapsedTimer>
+#include <QtConcurrent>
+#include <QDebug>
+
+static bool is_onnx(const QString &model)
+{
+    return model.endsWith(".onnx", Qt::CaseInsensitive);
+}
+
+static FaceRecognizerBackend *make_recognizer(const QString &model)
+{
+    const ServerConfig &config = ServerConfig::get();
+    if(!is_onnx(model)) return new SeetaRecognizer(model);
+    DnnParams params = config.dnnRecognizer;
+    params.model = model;
+    return new DnnRecognizer(params);
+}
+
+FaceModels &FaceModels::instance()
+{
+    static FaceModels models;
+    return models;
+}
+
+FaceModels::FaceModels()
+{
+    //OpenCV DNN的线程数是全局的
+    int threads = ServerConfig::get().backendThreads;
+    if(threads > 0)
+        cv::setNumThreads(threads);
+}
+
+FaceModels::~FaceModels()
+{
+    for(FaceEngine *e : engines)
+    {
+        delete e->detector;
+        delete e->landmarker;
+        delete e->recognizer;
+        delete e->light;
+        delete e;
+    }
+}
+
+FaceEngine *FaceModels::load()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    //几个模型文件互不相关, 同时读取和解析, 总耗时接近最大的特征提取模型
+    const ServerConfig &config = ServerConfig::get();
+    QFuture<FaceDetectorBackend*> fd = QtConcurrent::run([&config]() -> FaceDetectorBackend* {
+        if(!is_onnx(config.detectorModel)) return new SeetaDetector(config.detectorModel, config.backendThreads);
+        DnnParams params = config.dnnDetector;
+        params.model = config.detectorModel;
+        return new DnnDetector(params);
+    });
+    QFuture<FaceLandmarkerBackend*> pd = QtConcurrent::run([&config]() -> FaceLandmarkerBackend* {
+        return new SeetaLandmarker(config.landmarkerModel);
+    });
+    //级联的小模型是可选的
+    QFuture<FaceRecognizerBackend*> lr = QtConcurrent::run([&config]() -> FaceRecognizerBackend* {
+        return config.lightModel.isEmpty() ? nullptr : make_recognizer(config.lightModel);
+    });
+
+    FaceEngine *e = new FaceEngine;
+    e->recognizer = make_recognizer(config.recognizerModel);
+    e->detector = fd.result();
+    e->landmarker = pd.result();
+    e->light = lr.result();
+    qDebug()<<"加载模型耗时(ms):"<<timer.elapsed()<<"检测:"<<e->detector->name()
+            <<"关键点:"<<e->landmarker->name()<<"特征:"<<e->recognizer->name();
+    return e;
+}
+
+FaceEngine *FaceModels::acquire()
+{
+    {
+        QMutexLocker locker(&mutex);
+        if(!idle.isEmpty())
+            return idle.takeLast();
+    }
+
+    FaceEngine *e = load();
+    QMutexLocker locker(&mutex);
+    engines.append(e);
+    return e;
+}
+
+void FaceModels::release(FaceEngine *engine)
+{
+    if(engine == nullptr) return;
+    QMutexLocker locker(&mutex);
+    idle.append(engine);
+}
+
+int FaceModels::loaded() const
+{
+    QMutexLocker locker(&mutex);
+    return engines.size();
+}
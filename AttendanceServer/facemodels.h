@@ -0,0 +1,47 @@
+﻿#ifndef FACEMODELS_H
+#define FACEMODELS_H
+
+#include <QMutex>
+#include <QList>
+#include "facebackend.h"
+
+//一套识别用的模型实例: 检测, 关键点, 特征提取
+//模型对象不能多个线程同时调用, 同一时间只借给一个使用者
+//每一步用哪种实现由模型文件决定: .onnx 用OpenCV DNN, 其他用SeetaFace
+struct FaceEngine
+{
+    FaceDetectorBackend *detector;
+    FaceLandmarkerBackend *landmarker;
+    FaceRecognizerBackend *recognizer;
+    FaceRecognizerBackend *light;   //级联识别第一级的小模型, 没有配置时为空
+};
+
+//进程内共用的模型登记表
+//模型第一次用到时才加载, 用完的实例还回来留给下一个使用者,
+//注册, 导入和识别线程之间不再每次重新加载模型文件
+class FaceModels
+{
+public:
+    static FaceModels &instance();
+
+    //借一套模型, 没有空闲的才加载新的一套(不持锁加载, 多个线程可以同时加载)
+    //一套里的几个模型并行加载
+    FaceEngine *acquire();
+    void release(FaceEngine *engine);
+
+    //已经加载的套数
+    int loaded() const;
+
+private:
+    FaceModels();
+    ~FaceModels();
+    Q_DISABLE_COPY(FaceModels)
+
+    static FaceEngine *load();
+
+    mutable QMutex mutex;
+    QList<FaceEngine*> idle;
+    QList<FaceEngine*> engines;
+};
+
+#endif // FACEMODELS_H
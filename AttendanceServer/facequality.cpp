@@ -0,0 +1,63 @@
+﻿#include "facequality.h"
+#include <opencv.hpp>
+#include <cmath>
+#include <algorithm>
+
+//清晰度在固定大小的人脸上算, 大脸和小脸的阈值一样
+static const int SharpnessSize = 64;
+
+FaceQuality::Reason FaceQuality::check(const SeetaImageData &image, const SeetaRect &face, const SeetaPointF *points, const Params &params)
+{
+    if(!params.enabled) return Ok;
+
+    if(std::min(face.width, face.height) < params.minFace) return TooSmall;
+
+    //姿态: 正脸时鼻尖在两眼中点正下方, 并且在眼睛和嘴角之间
+    double eyeDx = points[1].x - points[0].x;
+    double eyeDy = points[1].y - points[0].y;
+    double eyeDist = std::sqrt(eyeDx * eyeDx + eyeDy * eyeDy);
+    if(eyeDist < 1) return Pose;
+    double eyeMidX = (points[0].x + points[1].x) / 2;
+    double eyeMidY = (points[0].y + points[1].y) / 2;
+    double mouthMidY = (points[3].y + points[4].y) / 2;
+    double roll = std::atan2(std::fabs(eyeDy), std::fabs(eyeDx)) * 180 / CV_PI;
+    if(std::fabs(points[2].x - eyeMidX) / eyeDist > params.maxYaw || roll > params.maxRoll
+       || points[2].y <= eyeMidY || points[2].y >= mouthMidY)
+        return Pose;
+
+    //亮度和清晰度只看人脸区域, 先缩小再算
+    cv::Mat whole(image.height, image.width, CV_8UC(image.channels), image.data);
+    cv::Rect box = cv::Rect(face.x, face.y, face.width, face.height) & cv::Rect(0, 0, image.width, image.height);
+    if(box.width <= 0 || box.height <= 0) return TooSmall;
+    cv::Mat small, gray;
+    cv::resize(whole(box), small, cv::Size(SharpnessSize, SharpnessSize), 0, 0, cv::INTER_AREA);
+    if(small.channels() == 3)
+        cv::cvtColor(small, gray, cv::COLOR_BGR2GRAY);
+    else
+        gray = small;
+
+    double brightness = cv::mean(gray)[0];
+    if(brightness < params.minBrightness) return TooDark;
+    if(brightness > params.maxBrightness) return TooBright;
+
+    cv::Mat lap;
+    cv::Laplacian(gray, lap, CV_64F);
+    cv::Scalar mean, stddev;
+    cv::meanStdDev(lap, mean, stddev);
+    if(stddev[0] * stddev[0] < params.minSharpness) return Blurry;
+
+    return Ok;
+}
+
+const char *FaceQuality::name(Reason reason)
+{
+    switch(reason)
+    {
+    case TooSmall: return "too_small";
+    case Blurry: return "blurry";
+    case TooDark: return "too_dark";
+    case TooBright: return "too_bright";
+    case Pose: return "pose";
+    default: return "ok";
+    }
+}
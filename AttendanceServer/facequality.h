@@ -0,0 +1,40 @@
+﻿#ifndef FACEQUALITY_H
+#define FACEQUALITY_H
+
+#include <seeta/CStruct.h>
+
+//提取特征之前的人脸质量检查
+//模糊, 太小, 太暗太亮和侧脸的人脸提取出的特征认不出人, 白白花一次特征提取;
+//这里只用人脸框和5点关键点做几个很便宜的检查, 不合格的直接告诉考勤机原因, 让它换一帧再发
+
+namespace FaceQuality
+{
+    enum Reason
+    {
+        Ok = 0,
+        TooSmall,   //人脸框太小
+        Blurry,     //拉普拉斯方差太小
+        TooDark,
+        TooBright,
+        Pose        //侧脸, 低头抬头或歪头太多
+    };
+
+    struct Params
+    {
+        bool enabled = true;
+        int minFace = 60;           //人脸框最短边(像素)
+        double minSharpness = 30;   //人脸缩放到64x64后拉普拉斯响应的方差
+        int minBrightness = 50;     //人脸区域平均灰度
+        int maxBrightness = 210;
+        double maxYaw = 0.35;       //鼻尖偏离两眼中点的距离 / 两眼距离
+        double maxRoll = 20;        //两眼连线的倾斜角度
+    };
+
+    //points是5点关键点(左眼,右眼,鼻尖,左嘴角,右嘴角)
+    Reason check(const SeetaImageData &image, const SeetaRect &face, const SeetaPointF *points, const Params &params);
+
+    //回复给考勤机的原因代码
+    const char *name(Reason reason);
+}
+
+#endif // FACEQUALITY_H
@@ -0,0 +1,274 @@
+﻿#include "featuremath.h"
+#include <cmath>
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FEATUREMATH_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define FEATUREMATH_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+
+float dot_scalar(const float *a, const float *b, int stride)
+{
+    float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    for(int i = 0; i < stride; i += 4)
+    {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+int32_t dot_i8_scalar(const int8_t *a, const int8_t *b, int stride)
+{
+    int32_t sum = 0;
+    for(int i = 0; i < stride; i++)
+        sum += int32_t(a[i]) * int32_t(b[i]);
+    return sum;
+}
+
+#ifdef FEATUREMATH_X86
+
+__attribute__((target("sse2")))
+float dot_sse(const float *a, const float *b, int stride)
+{
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    __m128 acc2 = _mm_setzero_ps();
+    __m128 acc3 = _mm_setzero_ps();
+    for(int i = 0; i < stride; i += 16)
+    {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_load_ps(a + i),      _mm_load_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_load_ps(a + i + 4),  _mm_load_ps(b + i + 4)));
+        acc2 = _mm_add_ps(acc2, _mm_mul_ps(_mm_load_ps(a + i + 8),  _mm_load_ps(b + i + 8)));
+        acc3 = _mm_add_ps(acc3, _mm_mul_ps(_mm_load_ps(a + i + 12), _mm_load_ps(b + i + 12)));
+    }
+    __m128 acc = _mm_add_ps(_mm_add_ps(acc0, acc1), _mm_add_ps(acc2, acc3));
+    float out[4];
+    _mm_storeu_ps(out, acc);
+    return (out[0] + out[1]) + (out[2] + out[3]);
+}
+
+__attribute__((target("avx2,fma")))
+float dot_avx2(const float *a, const float *b, int stride)
+{
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    for(int i = 0; i < stride; i += 16)
+    {
+        acc0 = _mm256_fmadd_ps(_mm256_load_ps(a + i),     _mm256_load_ps(b + i),     acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_load_ps(a + i + 8), _mm256_load_ps(b + i + 8), acc1);
+    }
+    __m256 acc = _mm256_add_ps(acc0, acc1);
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+}
+
+//一次算4行, query 从缓存读一遍给4行共用
+__attribute__((target("avx2,fma")))
+void dot_rows_avx2(const float *q, const float *m, int rows, int stride, float *scores)
+{
+    int r = 0;
+    for(; r + 4 <= rows; r += 4)
+    {
+        const float *m0 = m + (long long)r * stride;
+        const float *m1 = m0 + stride;
+        const float *m2 = m1 + stride;
+        const float *m3 = m2 + stride;
+        __m256 a0 = _mm256_setzero_ps();
+        __m256 a1 = _mm256_setzero_ps();
+        __m256 a2 = _mm256_setzero_ps();
+        __m256 a3 = _mm256_setzero_ps();
+        for(int i = 0; i < stride; i += 8)
+        {
+            __m256 x = _mm256_load_ps(q + i);
+            a0 = _mm256_fmadd_ps(x, _mm256_load_ps(m0 + i), a0);
+            a1 = _mm256_fmadd_ps(x, _mm256_load_ps(m1 + i), a1);
+            a2 = _mm256_fmadd_ps(x, _mm256_load_ps(m2 + i), a2);
+            a3 = _mm256_fmadd_ps(x, _mm256_load_ps(m3 + i), a3);
+        }
+        //4个累加器横向求和
+        __m256 s01 = _mm256_hadd_ps(a0, a1);
+        __m256 s23 = _mm256_hadd_ps(a2, a3);
+        __m256 s = _mm256_hadd_ps(s01, s23);
+        __m128 out = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+        _mm_storeu_ps(scores + r, out);
+    }
+    for(; r < rows; r++)
+        scores[r] = dot_avx2(q, m + (long long)r * stride, stride);
+}
+
+//int8扩展成int16后用 madd 相乘并两两相加, 127*127*2 不会溢出int16对应的int32结果
+__attribute__((target("sse2")))
+int32_t dot_i8_sse(const int8_t *a, const int8_t *b, int stride)
+{
+    __m128i acc = _mm_setzero_si128();
+    for(int i = 0; i < stride; i += 16)
+    {
+        __m128i x = _mm_load_si128(reinterpret_cast<const __m128i *>(a + i));
+        __m128i y = _mm_load_si128(reinterpret_cast<const __m128i *>(b + i));
+        //SSE2没有符号扩展指令, 先复制到高字节再算术右移
+        __m128i xlo = _mm_srai_epi16(_mm_unpacklo_epi8(x, x), 8);
+        __m128i xhi = _mm_srai_epi16(_mm_unpackhi_epi8(x, x), 8);
+        __m128i ylo = _mm_srai_epi16(_mm_unpacklo_epi8(y, y), 8);
+        __m128i yhi = _mm_srai_epi16(_mm_unpackhi_epi8(y, y), 8);
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(xlo, ylo));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(xhi, yhi));
+    }
+    int32_t out[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), acc);
+    return (out[0] + out[1]) + (out[2] + out[3]);
+}
+
+__attribute__((target("avx2")))
+int32_t dot_i8_avx2(const int8_t *a, const int8_t *b, int stride)
+{
+    __m256i acc = _mm256_setzero_si256();
+    for(int i = 0; i < stride; i += 16)
+    {
+        __m256i x = _mm256_cvtepi8_epi16(_mm_load_si128(reinterpret_cast<const __m128i *>(a + i)));
+        __m256i y = _mm256_cvtepi8_epi16(_mm_load_si128(reinterpret_cast<const __m128i *>(b + i)));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(x, y));
+    }
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(sum);
+}
+
+#endif // FEATUREMATH_X86
+
+#ifdef FEATUREMATH_NEON
+
+float dot_neon(const float *a, const float *b, int stride)
+{
+    float32x4_t acc0 = vdupq_n_f32(0);
+    float32x4_t acc1 = vdupq_n_f32(0);
+    float32x4_t acc2 = vdupq_n_f32(0);
+    float32x4_t acc3 = vdupq_n_f32(0);
+    for(int i = 0; i < stride; i += 16)
+    {
+        acc0 = vmlaq_f32(acc0, vld1q_f32(a + i),      vld1q_f32(b + i));
+        acc1 = vmlaq_f32(acc1, vld1q_f32(a + i + 4),  vld1q_f32(b + i + 4));
+        acc2 = vmlaq_f32(acc2, vld1q_f32(a + i + 8),  vld1q_f32(b + i + 8));
+        acc3 = vmlaq_f32(acc3, vld1q_f32(a + i + 12), vld1q_f32(b + i + 12));
+    }
+    float32x4_t acc = vaddq_f32(vaddq_f32(acc0, acc1), vaddq_f32(acc2, acc3));
+    float32x2_t sum = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+    return vget_lane_f32(vpadd_f32(sum, sum), 0);
+}
+
+int32_t dot_i8_neon(const int8_t *a, const int8_t *b, int stride)
+{
+    int32x4_t acc = vdupq_n_s32(0);
+    for(int i = 0; i < stride; i += 16)
+    {
+        int8x16_t x = vld1q_s8(a + i);
+        int8x16_t y = vld1q_s8(b + i);
+        //8位相乘得到16位, 再两两累加到32位
+        acc = vpadalq_s16(acc, vmull_s8(vget_low_s8(x), vget_low_s8(y)));
+        acc = vpadalq_s16(acc, vmull_s8(vget_high_s8(x), vget_high_s8(y)));
+    }
+    int32x2_t sum = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+    return vget_lane_s32(vpadd_s32(sum, sum), 0);
+}
+
+#endif // FEATUREMATH_NEON
+
+typedef float (*DotFn)(const float *, const float *, int);
+typedef int32_t (*DotI8Fn)(const int8_t *, const int8_t *, int);
+
+struct Kernel
+{
+    DotFn dot;
+    void (*rows)(const float *, const float *, int, int, float *);
+    DotI8Fn dot_i8;
+    const char *name;
+};
+
+template<DotFn Dot>
+void dot_rows_generic(const float *q, const float *m, int rows, int stride, float *scores)
+{
+    for(int r = 0; r < rows; r++)
+        scores[r] = Dot(q, m + (long long)r * stride, stride);
+}
+
+Kernel select_kernel()
+{
+#ifdef FEATUREMATH_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return Kernel{ dot_avx2, dot_rows_avx2, dot_i8_avx2, "AVX2+FMA" };
+    if(__builtin_cpu_supports("sse2"))
+        return Kernel{ dot_sse, dot_rows_generic<dot_sse>, dot_i8_sse, "SSE2" };
+#endif
+#ifdef FEATUREMATH_NEON
+    return Kernel{ dot_neon, dot_rows_generic<dot_neon>, dot_i8_neon, "NEON" };
+#endif
+    return Kernel{ dot_scalar, dot_rows_generic<dot_scalar>, dot_i8_scalar, "scalar" };
+}
+
+const Kernel &kernel()
+{
+    static const Kernel k = select_kernel();
+    return k;
+}
+
+} // namespace
+
+namespace FeatureMath
+{
+
+float dot(const float *a, const float *b, int stride)
+{
+    return kernel().dot(a, b, stride);
+}
+
+void dot_rows(const float *query, const float *matrix, int rows, int stride, float *scores)
+{
+    kernel().rows(query, matrix, rows, stride, scores);
+}
+
+float quantize(const float *features, int dim, int stride, int8_t *out)
+{
+    float maxAbs = 0;
+    for(int i = 0; i < dim; i++)
+        maxAbs = std::max(maxAbs, std::fabs(features[i]));
+    float scale = maxAbs > 0 ? maxAbs / 127.0f : 1.0f;
+    float inv = 1.0f / scale;
+    for(int i = 0; i < dim; i++)
+        out[i] = int8_t(std::lround(features[i] * inv));
+    for(int i = dim; i < stride; i++)
+        out[i] = 0;
+    return scale;
+}
+
+int32_t dot_i8(const int8_t *a, const int8_t *b, int stride)
+{
+    return kernel().dot_i8(a, b, stride);
+}
+
+void dot_rows_i8(const int8_t *query, const int8_t *matrix, int rows, int stride, int32_t *scores)
+{
+    DotI8Fn fn = kernel().dot_i8;
+    for(int r = 0; r < rows; r++)
+        scores[r] = fn(query, matrix + (long long)r * stride, stride);
+}
+
+const char *isa()
+{
+    return kernel().name;
+}
+
+}
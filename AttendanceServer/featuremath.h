@@ -0,0 +1,49 @@
+﻿#ifndef FEATUREMATH_H
+#define FEATUREMATH_H
+
+#include <stdint.h>
+
+//特征向量运算
+//x86 运行时按CPU选择 AVX2+FMA / SSE 实现, ARM 使用 NEON, 其他平台用普通循环
+//矩阵每行长度(stride)必须是 FeatureMath::Lanes 的整数倍, 补齐部分填0, 首地址按 Alignment 对齐
+
+namespace FeatureMath
+{
+    enum { Lanes = 16, Alignment = 64 };
+
+    //把维度补齐到 Lanes 的整数倍
+    inline int padded(int dim) { return (dim + Lanes - 1) / Lanes * Lanes; }
+
+    //两个长度为stride的向量点积
+    float dot(const float *a, const float *b, int stride);
+
+    //query 和矩阵的 rows 行分别求点积, 结果写入 scores
+    void dot_rows(const float *query, const float *matrix, int rows, int stride, float *scores);
+
+    //int8量化: code = round(x / scale), scale = max|x| / 127, 返回scale
+    //out 长度为stride, 补齐部分填0
+    float quantize(const float *features, int dim, int stride, int8_t *out);
+
+    //int8向量点积, 乘上两边的scale就是近似的浮点点积
+    int32_t dot_i8(const int8_t *a, const int8_t *b, int stride);
+    void dot_rows_i8(const int8_t *query, const int8_t *matrix, int rows, int stride, int32_t *scores);
+
+    //分两段存放的特征矩阵, 前 headRows 行在 head, 后面的行在 tail, 每段内部连续
+    struct Rows
+    {
+        const float *head;
+        const float *tail;
+        int headRows;
+        int stride;
+
+        const float *operator[](int i) const
+        {
+            return i < headRows ? head + (long long)i * stride : tail + (long long)(i - headRows) * stride;
+        }
+    };
+
+    //当前使用的实现, 打印日志用
+    const char *isa();
+}
+
+#endif // FEATUREMATH_H
@@ -0,0 +1,144 @@
+﻿#include "frameparser.h"
+#include <QtEndian>
+#include <QDebug>
+
+//第一次分配的缓冲区大小, 一般够放一两张480x480的jpg
+static const int InitialBufferSize = 128 * 1024;
+
+FrameParser::FrameParser(int maxFrameSize)
+    : used(0), consumed(0), maxFrame(maxFrameSize), error(false)
+{
+    buf.resize(InitialBufferSize);
+}
+
+void FrameParser::reset()
+{
+    used = 0;
+    consumed = 0;
+    error = false;
+}
+
+char *FrameParser::reserve(int want)
+{
+    int remain = used - consumed;
+    //前面已经交出去的帧不再需要, 把剩下的半帧挪到开头
+    if(consumed > 0)
+    {
+        if(remain > 0)
+            memmove(buf.data(), buf.constData() + consumed, remain);
+        used = remain;
+        consumed = 0;
+    }
+
+    //当前这一帧需要多少空间: 头部完整时可以知道整帧长度
+    int need = used + want;
+    if(used >= HeaderSize)
+    {
+        quint32 len = qFromBigEndian<quint32>(buf.constData() + 8);
+        if(len <= (quint32)maxFrame)
+            need = qMax(need, HeaderSize + (int)len);
+    }
+    if(need > buf.size())
+    {
+        buf.resize(qMax(need, buf.size() * 2));
+    }
+    return buf.data() + used;
+}
+
+qint64 FrameParser::feed(QIODevice *dev)
+{
+    if(error) return 0;
+
+    qint64 total = 0;
+    qint64 avail = dev->bytesAvailable();
+    while(avail > 0)
+    {
+        char *dst = reserve(0);
+        int space = buf.size() - used;
+        if(space == 0) break; //缓冲区里全是完整帧, 先交给上层处理
+        qint64 n = dev->read(dst, qMin<qint64>(avail, space));
+        if(n <= 0) break;
+        used += n;
+        total += n;
+        avail = dev->bytesAvailable();
+    }
+    return total;
+}
+
+qint64 FrameParser::feed(const char *data, qint64 len)
+{
+    if(error) return 0;
+
+    char *dst = reserve((int)len);
+    memcpy(dst, data, len);
+    used += len;
+    return len;
+}
+
+bool FrameParser::next(Frame &frame)
+{
+    if(error) return false;
+
+    int remain = used - consumed;
+    if(remain < HeaderSize) return false; //头部还没有收全
+
+    const char *head = buf.constData() + consumed;
+    quint64 bsize = qFromBigEndian<quint64>(head);
+    quint32 len = qFromBigEndian<quint32>(head + 8);
+    int type = int(bsize >> 56);
+    bsize &= Q_UINT64_C(0x00FFFFFFFFFFFFFF);
+
+    //QDataStream把空的QByteArray写成0xFFFFFFFF
+    if(len == 0xFFFFFFFF) len = 0;
+
+    //外层长度就是QByteArray的长度, 和它自带的长度必须一致
+    if(bsize != len || len > (quint32)maxFrame || type > EmbeddingFrame)
+    {
+        qDebug()<<"数据帧格式错误"<<type<<bsize<<len;
+        error = true;
+        return false;
+    }
+
+    if(remain < HeaderSize + (int)len) return false; //数据还没有发送完成
+
+    int hintBytes = 0;
+    frame.hint = FaceHint();
+    if(type == HintedFrame && !parse_hint(head + HeaderSize, len, frame.hint, hintBytes))
+    {
+        qDebug()<<"人脸位置格式错误"<<len;
+        error = true;
+        return false;
+    }
+    frame.type = type;
+    frame.data = head + HeaderSize + hintBytes;
+    frame.size = len - hintBytes;
+    consumed += HeaderSize + len;
+    return true;
+}
+
+bool FrameParser::parse_hint(const char *data, int size, FaceHint &hint, int &used)
+{
+    if(size < 20) return false;
+    qint32 x = qFromBigEndian<qint32>(data);
+    qint32 y = qFromBigEndian<qint32>(data + 4);
+    qint32 w = qFromBigEndian<qint32>(data + 8);
+    qint32 h = qFromBigEndian<qint32>(data + 12);
+    quint32 n = qFromBigEndian<quint32>(data + 16);
+    if((n != 0 && n != 5) || size < 20 + (int)n * 8) return false;
+
+    hint.valid = true;
+    hint.box = QRect(x, y, w, h);
+    hint.points.clear();
+    for(quint32 i = 0; i < n; i++)
+    {
+        //float按大端的IEEE格式传输
+        quint32 px = qFromBigEndian<quint32>(data + 20 + i * 8);
+        quint32 py = qFromBigEndian<quint32>(data + 24 + i * 8);
+        float fx, fy;
+        memcpy(&fx, &px, sizeof(fx));
+        memcpy(&fy, &py, sizeof(fy));
+        hint.points.append(QPointF(fx, fy));
+    }
+    used = 20 + n * 8;
+    return true;
+}
@@ -0,0 +1,71 @@
+﻿#ifndef FRAMEPARSER_H
+#define FRAMEPARSER_H
+
+#include <QByteArray>
+#include <QIODevice>
+#include <QRect>
+#include <QPointF>
+#include <QVector>
+
+//考勤机已经检测到的人脸位置, 服务器可以跳过检测直接定位关键点和提取特征
+struct FaceHint
+{
+    bool valid = false;
+    QRect box;
+    QVector<QPointF> points;    //5点关键点, 没有时为空
+};
+
+//考勤机发送的数据帧: QDataStream写出的 quint64 长度 + QByteArray(quint32 长度 + 数据), 都是大端
+//quint64 的最高字节是消息类型, 低56位才是长度; 旧考勤机最高字节为0, 就是普通的jpg帧
+//带人脸位置的帧(HintedFrame)在jpg前面多一段: qint32 x,y,w,h + quint32 关键点数(0或5) + 关键点(float x,y)
+//特征帧(EmbeddingFrame)里没有图像, 是考勤机自己提取的特征, 格式见 faceembedding.h
+//解析器自己维护一块可复用的接收缓冲区, 一次readyRead里把能解析的帧全部取出来,
+//缓冲区只在遇到更大的帧时才扩容, 平时不分配内存
+
+class FrameParser
+{
+public:
+    //8字节外层长度 + 4字节QByteArray长度
+    enum { HeaderSize = 12 };
+
+    //消息类型
+    enum Type { ImageFrame = 0, HintedFrame = 1, EmbeddingFrame = 2 };
+
+    //指向解析器内部缓冲区, 下一次 feed() 之前有效
+    struct Frame
+    {
+        int type;
+        const char *data;   //jpg数据, 特征帧时是编码后的特征
+        int size;
+        FaceHint hint;
+    };
+
+    explicit FrameParser(int maxFrameSize = 8 * 1024 * 1024);
+
+    //把设备里当前可读的数据读进缓冲区, 返回读到的字节数
+    qint64 feed(QIODevice *dev);
+    //直接追加一段数据
+    qint64 feed(const char *data, qint64 len);
+
+    //取出下一帧完整数据, 没有完整帧返回false
+    bool next(Frame &frame);
+
+    //数据格式错误, 连接应该断开
+    bool hasError() const { return error; }
+    //缓冲区里还没有解析的字节数
+    int buffered() const { return used - consumed; }
+    void reset();
+
+private:
+    //把未解析的数据移到缓冲区开头, 并保证还能放下 want 字节
+    char *reserve(int want);
+    static bool parse_hint(const char *data, int size, FaceHint &hint, int &used);
+
+    QByteArray buf;
+    int used;       //缓冲区中已写入的字节
+    int consumed;   //已经交给上层的字节
+    int maxFrame;
+    bool error;
+};
+
+#endif // FRAMEPARSER_H
@@ -0,0 +1,296 @@
+﻿#include "galleryjournal.h"
+#include "facegallery.h"
+#include <QMutexLocker>
+#include <QDebug>
+#include <cstring>
+#include <cstddef>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+static const quint32 JournalMagic = 0x464A4C31; // "FJL1"
+static const quint32 JournalVersion = 1;
+
+namespace
+{
+struct FileHeader
+{
+    quint32 magic;
+    quint32 version;
+};
+
+//每条记录: 记录头 + 特征, 校验覆盖faceID和特征
+struct RecordHeader
+{
+    quint32 bytes;      //特征的字节数
+    quint16 op;
+    quint16 checksum;
+    qint64 faceid;
+};
+
+bool flush_to_disk(QFile &file)
+{
+    if(!file.flush()) return false;
+#ifdef Q_OS_WIN
+    return _commit(file.handle()) == 0;
+#else
+    return ::fsync(file.handle()) == 0;
+#endif
+}
+}
+
+GalleryJournal::GalleryJournal(const QString &path)
+    : filePath(path), count(0), pending(0)
+{
+}
+
+GalleryJournal::~GalleryJournal()
+{
+    close();
+}
+
+QVector<GalleryJournal::Record> GalleryJournal::read(const QString &path, qint64 *validBytes)
+{
+    QVector<Record> records;
+    if(validBytes) *validBytes = 0;
+
+    QFile in(path);
+    if(!in.open(QIODevice::ReadOnly)) return records;
+    QByteArray data = in.readAll();
+
+    FileHeader fh;
+    if(data.size() < (int)sizeof(fh)) return records;
+    memcpy(&fh, data.constData(), sizeof(fh));
+    if(fh.magic != JournalMagic || fh.version != JournalVersion)
+    {
+        qDebug()<<"日志格式错误:"<<path;
+        return records;
+    }
+
+    int pos = sizeof(fh);
+    while(pos + (int)sizeof(RecordHeader) <= data.size())
+    {
+        RecordHeader rh;
+        memcpy(&rh, data.constData() + pos, sizeof(rh));
+        int end = pos + sizeof(rh) + rh.bytes;
+        if(rh.bytes % sizeof(float) != 0 || rh.bytes > (quint32)data.size() || end > data.size())
+            break;
+        const char *body = data.constData() + pos + offsetof(RecordHeader, faceid);
+        if(qChecksum(body, sizeof(rh.faceid) + rh.bytes) != rh.checksum)
+            break;
+
+        Record r;
+        r.op = rh.op;
+        r.faceid = rh.faceid;
+        r.checksum = rh.checksum;
+        r.features.resize(rh.bytes / sizeof(float));
+        if(rh.bytes > 0)
+            memcpy(r.features.data(), data.constData() + pos + sizeof(rh), rh.bytes);
+        records.append(r);
+        pos = end;
+    }
+
+    if(pos < data.size())
+        qDebug()<<"日志末尾有不完整的记录, 丢弃"<<(data.size() - pos)<<"字节:"<<path;
+    if(validBytes) *validBytes = pos;
+    return records;
+}
+
+quint64 GalleryJournal::key(int op, int64_t faceid, quint16 checksum)
+{
+    return (quint64(op) << 56) ^ (quint64(faceid) << 16) ^ checksum;
+}
+
+quint64 GalleryJournal::key(const Record &r)
+{
+    return key(r.op, r.faceid, r.checksum);
+}
+
+//打开前 FaceGallery 已经重放过两个日志, 里面的记录都算用过
+bool GalleryJournal::open()
+{
+    QMutexLocker locker(&mutex);
+    applied.clear();
+    sealedApplied.clear();
+    for(const Record &r : read(filePath))
+        applied[key(r)]++;
+    for(const Record &r : read(sealed_path()))
+        sealedApplied[key(r)]++;
+    return open_file();
+}
+
+//调用时已加锁
+bool GalleryJournal::open_file()
+{
+    qint64 valid = 0;
+    count = read(filePath, &valid).size();
+    pending = 0;
+
+    file.setFileName(filePath);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Append))
+    {
+        qDebug()<<"日志打开失败:"<<file.errorString();
+        return false;
+    }
+    //截掉不完整的记录, 否则后面追加的记录读不到
+    if(file.size() != valid && !file.resize(valid))
+    {
+        qDebug()<<"日志截断失败:"<<file.errorString();
+        file.close();
+        return false;
+    }
+    if(valid == 0)
+    {
+        FileHeader fh = { JournalMagic, JournalVersion };
+        file.write(reinterpret_cast<const char *>(&fh), sizeof(fh));
+        flush_to_disk(file);
+    }
+    return true;
+}
+
+void GalleryJournal::close()
+{
+    QMutexLocker locker(&mutex);
+    if(!file.isOpen()) return;
+    flush_to_disk(file);
+    file.close();
+}
+
+bool GalleryJournal::append(Op op, int64_t faceid, const float *features, int dim)
+{
+    RecordHeader rh;
+    rh.bytes = dim * sizeof(float);
+    rh.op = op;
+    rh.checksum = 0;
+    rh.faceid = faceid;
+
+    //整条记录一次写入, 其他进程以追加方式写同一个文件时不会交错
+    QByteArray record(sizeof(rh) + rh.bytes, 0);
+    char *p = record.data();
+    memcpy(p, &rh, sizeof(rh));
+    if(rh.bytes > 0)
+        memcpy(p + sizeof(rh), features, rh.bytes);
+    rh.checksum = qChecksum(p + offsetof(RecordHeader, faceid), sizeof(rh.faceid) + rh.bytes);
+    memcpy(p, &rh, sizeof(rh));
+
+    QMutexLocker locker(&mutex);
+    if(!file.isOpen()) return false;
+    if(file.write(record) != record.size() || !file.flush())
+    {
+        qDebug()<<"日志写入失败:"<<file.errorString();
+        return false;
+    }
+    count++;
+    pending++;
+    applied[key(op, faceid, rh.checksum)]++;
+    return true;
+}
+
+bool GalleryJournal::sync()
+{
+    QMutexLocker locker(&mutex);
+    if(pending == 0 || !file.isOpen()) return true;
+    pending = 0;
+    return flush_to_disk(file);
+}
+
+int GalleryJournal::unsynced() const
+{
+    QMutexLocker locker(&mutex);
+    return pending;
+}
+
+int GalleryJournal::records() const
+{
+    QMutexLocker locker(&mutex);
+    return count;
+}
+
+bool GalleryJournal::seal()
+{
+    QMutexLocker locker(&mutex);
+    //上次合并失败留下的封存日志还在, 先合并它, 当前日志留到下次
+    if(QFile::exists(sealed_path()) || count == 0) return true;
+
+    flush_to_disk(file);
+    file.close();
+    if(!QFile::rename(filePath, sealed_path()))
+    {
+        qDebug()<<"日志封存失败:"<<filePath;
+        open_file();
+        return false;
+    }
+    sealedApplied = applied;
+    applied.clear();
+    return open_file();
+}
+
+void GalleryJournal::remove_sealed()
+{
+    QMutexLocker locker(&mutex);
+    QFile::remove(sealed_path());
+    sealedApplied.clear();
+}
+
+void GalleryJournal::drop_applied(QVector<Record> &records)
+{
+    QMutexLocker locker(&mutex);
+    QHash<quint64, int> left = sealedApplied;
+    QVector<Record> unseen;
+    for(const Record &r : records)
+    {
+        QHash<quint64, int>::iterator it = left.find(key(r));
+        if(it != left.end() && it.value() > 0)
+        {
+            it.value()--;
+            continue;
+        }
+        unseen.append(r);
+    }
+    for(const Record &r : unseen)
+        sealedApplied[key(r)]++;
+    records = unseen;
+}
+
+JournalWorker::JournalWorker(FaceGallery *gallery, int syncMs, int compactRecords)
+    : gallery(gallery), syncMs(syncMs), compactRecords(compactRecords), stopping(false)
+{
+}
+
+void JournalWorker::wake()
+{
+    QMutexLocker locker(&mutex);
+    wakeup.wakeAll();
+}
+
+void JournalWorker::stop()
+{
+    {
+        QMutexLocker locker(&mutex);
+        stopping = true;
+        wakeup.wakeAll();
+    }
+    wait();
+}
+
+void JournalWorker::run()
+{
+    QMutexLocker locker(&mutex);
+    while(!stopping)
+    {
+        wakeup.wait(&mutex, syncMs);
+        if(stopping) break;
+        locker.unlock();
+
+        gallery->sync_journal();
+        if(compactRecords > 0 && gallery->journal_records() >= compactRecords)
+            gallery->compact_journal();
+        if(gallery->purge_due(*gallery->pin()))
+            gallery->purge();
+
+        locker.relock();
+    }
+}
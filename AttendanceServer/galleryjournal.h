@@ -0,0 +1,94 @@
+﻿#ifndef GALLERYJOURNAL_H
+#define GALLERYJOURNAL_H
+
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+
+class FaceGallery;
+
+//特征库日志: 注册时只在日志末尾追加一条记录, 不再每次重写整个特征库文件
+//每条记录带长度和校验, 崩溃后重启时丢弃末尾写了一半的记录
+//写入后只刷到系统缓存, fsync 由后台线程合并起来做
+//合并时先把当前日志改名封存, 新记录写到新日志, 特征库文件保存成功后删除封存的日志
+
+class GalleryJournal
+{
+public:
+    enum Op { Add = 1, Remove = 2, Update = 3 };
+
+    struct Record
+    {
+        int op;
+        int64_t faceid;
+        QVector<float> features;    //删除记录没有特征
+        quint16 checksum;
+    };
+
+    explicit GalleryJournal(const QString &path);
+    ~GalleryJournal();
+
+    QString path() const { return filePath; }
+    QString sealed_path() const { return filePath + ".sealed"; }
+
+    //打开日志准备追加, 末尾不完整的记录截掉
+    bool open();
+    void close();
+    bool append(Op op, int64_t faceid, const float *features, int dim);
+    //已写入的记录刷到磁盘
+    bool sync();
+    int unsynced() const;
+    //当前日志里的记录数
+    int records() const;
+    //当前日志改名封存, 之后的记录写到新文件; 上次封存的还没删除时不再封存
+    bool seal();
+    void remove_sealed();
+    //去掉封存日志里本进程已经用过的记录(自己写的, 打开时重放过的), 剩下的是其他进程写的
+    //返回的记录之后也算用过, 合并失败重试时不会再用一次
+    void drop_applied(QVector<Record> &records);
+
+    //读出日志文件里完整的记录
+    static QVector<Record> read(const QString &path, qint64 *validBytes = nullptr);
+
+private:
+    Q_DISABLE_COPY(GalleryJournal)
+
+    bool open_file();
+    static quint64 key(const Record &r);
+    static quint64 key(int op, int64_t faceid, quint16 checksum);
+
+    QString filePath;
+    QFile file;
+    mutable QMutex mutex;
+    int count;          //当前日志里的记录数
+    int pending;        //还没fsync的记录数
+    //本进程已经用到特征库里的记录, 按(操作, faceID, 校验)计数; 同一个进程封存前后各一份
+    QHash<quint64, int> applied;
+    QHash<quint64, int> sealedApplied;
+};
+
+//后台线程: 定时把日志fsync到磁盘, 日志记录数达到阈值时合并进特征库文件, 墓碑太多时清理特征库
+class JournalWorker : public QThread
+{
+public:
+    JournalWorker(FaceGallery *gallery, int syncMs, int compactRecords);
+
+    void wake();
+    void stop();
+
+protected:
+    void run() override;
+
+private:
+    FaceGallery *gallery;
+    int syncMs;
+    int compactRecords;
+    QMutex mutex;
+    QWaitCondition wakeup;
+    bool stopping;
+};
+
+#endif // GALLERYJOURNAL_H
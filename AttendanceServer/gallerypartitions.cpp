@@ -0,0 +1,144 @@
+﻿#include "gallerypartitions.h"
+#include "serverconfig.h"
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QMutexLocker>
+#include <QElapsedTimer>
+#include <QDebug>
+
+//每查这么多个人脸打印一次分区命中率
+static const int ReportInterval = 1000;
+
+GalleryPartitions::GalleryPartitions(QSharedPointer<FaceGallery> global)
+    : global(global), doors(ServerConfig::get().doors), fallbackGlobal(ServerConfig::get().partitionFallback),
+      searched(0), found(0)
+{
+}
+
+GalleryPartitions::~GalleryPartitions()
+{
+    global->set_listener(nullptr);
+}
+
+int GalleryPartitions::load()
+{
+    QHash<QString, Partition> loaded;
+    QSqlQuery query;
+    query.exec("select name, faceID from gallery_partition where faceID >= 0");
+    while(query.next())
+    {
+        loaded[query.value(0).toString()].members.insert(query.value(1).toLongLong());
+    }
+    //考勤机对应的分区还没有成员时也建好, 以后注册的人直接加进去
+    for(const QString &name : doors)
+    {
+        if(!loaded.contains(name))
+            loaded[name] = Partition();
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    int rows = 0;
+    for(QHash<QString, Partition>::iterator it = loaded.begin(); it != loaded.end(); ++it)
+    {
+        it.value().gallery = QSharedPointer<FaceGallery>(new FaceGallery(global->dim()));
+        if(!it.value().members.isEmpty())
+            rows += global->copy_to(*it.value().gallery, it.value().members);
+    }
+
+    int count = loaded.size();
+    {
+        QMutexLocker locker(&mutex);
+        partitions = loaded;
+    }
+    //复制和登记之间的修改会漏掉, 所以在识别线程启动前调用
+    //登记要拿特征库的写锁, 不能拿着 mutex(通知时的加锁顺序是先写锁后 mutex)
+    global->set_listener(count > 0 ? this : nullptr);
+    qDebug()<<"特征库分区数:"<<count<<"分区人数:"<<rows<<"耗时(ms):"<<timer.elapsed()
+            <<"考勤机门口数:"<<doors.size();
+    return count;
+}
+
+bool GalleryPartitions::store(const QString &name, int64_t faceid)
+{
+    QSqlQuery query;
+    query.prepare("insert or ignore into gallery_partition(name, faceID) values(?, ?)");
+    query.addBindValue(name);
+    query.addBindValue(qint64(faceid));
+    if(!query.exec())
+    {
+        qDebug()<<"保存分区成员失败:"<<query.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+bool GalleryPartitions::assign(const QString &name, int64_t faceid)
+{
+    if(name.isEmpty() || faceid < 0 || !store(name, faceid)) return false;
+
+    QMutexLocker locker(&mutex);
+    QHash<QString, Partition>::iterator it = partitions.find(name);
+    if(it == partitions.end()) return true;
+    //先加成员再复制: 复制之后的修改由 row_changed 同步
+    it.value().members.insert(faceid);
+    global->copy_to(*it.value().gallery, QSet<int64_t>() << faceid);
+    return true;
+}
+
+QString GalleryPartitions::door(const QString &address) const
+{
+    return doors.value(address);
+}
+
+QSharedPointer<FaceGallery> GalleryPartitions::gallery(const QString &name)
+{
+    QMutexLocker locker(&mutex);
+    QHash<QString, Partition>::const_iterator it = partitions.constFind(name);
+    if(it == partitions.constEnd() || it.value().gallery->size() == 0)
+        return QSharedPointer<FaceGallery>();
+    return it.value().gallery;
+}
+
+bool GalleryPartitions::admits(const QString &name, int64_t faceid)
+{
+    if(name.isEmpty() || fallbackGlobal) return true;
+    QMutexLocker locker(&mutex);
+    QHash<QString, Partition>::const_iterator it = partitions.constFind(name);
+    //和 gallery() 一致: 分区不存在或者没有成员时查的是整个特征库
+    if(it == partitions.constEnd() || it.value().gallery->size() == 0)
+        return true;
+    return faceid >= 0 && it.value().members.contains(faceid);
+}
+
+void GalleryPartitions::row_changed(int64_t faceid, const float *features)
+{
+    QMutexLocker locker(&mutex);
+    for(Partition &p : partitions)
+    {
+        if(!p.members.contains(faceid)) continue;
+        //启动时整个特征库还是空的, 分区没有维度
+        if(!p.gallery->init(global->dim())) continue;
+        p.gallery->add(faceid, features);
+    }
+}
+
+void GalleryPartitions::row_removed(int64_t faceid)
+{
+    QMutexLocker locker(&mutex);
+    for(Partition &p : partitions)
+    {
+        if(p.members.contains(faceid))
+            p.gallery->remove(faceid);
+    }
+}
+
+void GalleryPartitions::record(int scoped, int hits)
+{
+    QMutexLocker locker(&mutex);
+    quint64 before = searched;
+    searched += scoped;
+    found += hits;
+    if(before / ReportInterval != searched / ReportInterval)
+        qDebug()<<"分区查找:"<<searched<<"分区内找到:"<<found<<"分区内没找到:"<<searched - found;
+}
@@ -0,0 +1,68 @@
+﻿#ifndef GALLERYPARTITIONS_H
+#define GALLERYPARTITIONS_H
+
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QMutex>
+#include <QSharedPointer>
+#include "facegallery.h"
+
+//按楼栋/部门划分的特征库分区
+//一台考勤机只服务一个门口, 来的基本都是这个门口的人: 先在考勤机所属分区里找, 没找到再查整个特征库
+//分区成员保存在数据库的 gallery_partition 表(faceID, name), 考勤机按IP地址在 server.ini 的 [doors] 里对应分区
+//启动时从整个特征库复制分区成员的特征, 之后整个特征库的每次修改(删除, 更新, 重放日志)逐条同步到所在的分区,
+//查询时不用重新生成分区; 注册新员工时 assign 把他加进填写的分区, 不用重启
+//分区名在 load 时确定(数据库里的和 [doors] 里的), 之后只修改分区的成员
+//所有识别线程共用
+
+class GalleryPartitions : public FaceGallery::Listener
+{
+public:
+    explicit GalleryPartitions(QSharedPointer<FaceGallery> global);
+    ~GalleryPartitions();
+
+    //从数据库读取分区成员并生成分区的特征库, 在数据库连接所在的界面线程, 识别线程启动之前调用, 返回分区数
+    int load();
+    bool enabled() const { return !partitions.isEmpty(); }
+    //分区里没找到时是否再查整个特征库
+    bool fallback() const { return fallbackGlobal; }
+
+    //把faceID加进分区: 写入数据库, 已加载的分区同时加入成员并复制特征(整个特征库里已经注册)
+    //在界面线程调用; 分区名不在 load 时的分区里时只写数据库, 下次启动生效
+    bool assign(const QString &name, int64_t faceid);
+    //只写数据库, 没有运行识别服务时注册用
+    static bool store(const QString &name, int64_t faceid);
+
+    //考勤机所属的分区, 没有配置时为空
+    QString door(const QString &address) const;
+    //分区的特征库, 分区不存在或者没有成员时为空
+    QSharedPointer<FaceGallery> gallery(const QString &name);
+    //缓存和小模型认出的人能否直接返回给这个分区的考勤机: 只查分区时必须是分区成员, 认不出(-1)也不能沿用
+    bool admits(const QString &name, int64_t faceid);
+
+    //记录一批分区查找: 查了多少个人脸, 其中在分区里找到的
+    void record(int scoped, int hits);
+
+    //整个特征库修改时在它的写锁里调用, 同步到成员所在的分区
+    void row_changed(int64_t faceid, const float *features) override;
+    void row_removed(int64_t faceid) override;
+
+private:
+    struct Partition
+    {
+        QSet<int64_t> members;
+        QSharedPointer<FaceGallery> gallery;
+    };
+
+    QSharedPointer<FaceGallery> global;
+    QHash<QString, QString> doors;  //考勤机IP -> 分区名
+    bool fallbackGlobal;
+
+    QMutex mutex;
+    QHash<QString, Partition> partitions;
+    quint64 searched;
+    quint64 found;
+};
+
+#endif // GALLERYPARTITIONS_H
@@ -0,0 +1,270 @@
+﻿#include "hnswindex.h"
+#include <algorithm>
+#include <queue>
+#include <cmath>
+
+namespace
+{
+//比较函数: 候选按相似度从高到低出队, 结果按相似度从低到高出队(堆顶是最差的)
+struct Better
+{
+    template<class C> bool operator()(const C &a, const C &b) const { return a.score < b.score; }
+};
+struct Worse
+{
+    template<class C> bool operator()(const C &a, const C &b) const { return a.score > b.score; }
+};
+
+//每个线程一份访问标记, 用版本号代替每次清零
+struct VisitedTags
+{
+    std::vector<unsigned> tags;
+    unsigned epoch = 0;
+
+    void reset(int n)
+    {
+        if((int)tags.size() < n) tags.resize(n, 0);
+        if(++epoch == 0)
+        {
+            std::fill(tags.begin(), tags.end(), 0);
+            epoch = 1;
+        }
+    }
+    bool visit(int row)
+    {
+        if(tags[row] == epoch) return false;
+        tags[row] = epoch;
+        return true;
+    }
+};
+
+VisitedTags &visited_tags()
+{
+    thread_local VisitedTags tags;
+    return tags;
+}
+
+inline float similarity(const float *query, const FeatureMath::Rows &data, int row)
+{
+    return FeatureMath::dot(query, data[row], data.stride);
+}
+}
+
+HnswIndex::HnswIndex(const Params &params)
+    : param(params), rng(20240601), entryPoint(-1), maxLevel(-1)
+{
+    param.M = std::max(2, param.M);
+    levelMult = 1.0 / std::log((double)param.M);
+}
+
+void HnswIndex::clear()
+{
+    levels.clear();
+    graph.clear();
+    entryPoint = -1;
+    maxLevel = -1;
+}
+
+int HnswIndex::random_level()
+{
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    double r = uniform(rng);
+    return (int)(-std::log(std::max(r, 1e-12)) * levelMult);
+}
+
+size_t HnswIndex::memory() const
+{
+    size_t bytes = levels.size() * sizeof(int);
+    for(const auto &node : graph)
+        for(const auto &l : node)
+            bytes += l.capacity() * sizeof(int) + sizeof(l);
+    return bytes;
+}
+
+std::vector<HnswIndex::Candidate> HnswIndex::search_layer(const float *query, const FeatureMath::Rows &data,
+                                                          int entry, int ef, int level) const
+{
+    VisitedTags &visited = visited_tags();
+    visited.reset((int)levels.size());
+
+    std::priority_queue<Candidate, std::vector<Candidate>, Better> candidates;
+    std::priority_queue<Candidate, std::vector<Candidate>, Worse> results;
+
+    Candidate start{ similarity(query, data, entry), entry };
+    visited.visit(entry);
+    candidates.push(start);
+    results.push(start);
+
+    while(!candidates.empty())
+    {
+        Candidate c = candidates.top();
+        //剩下的候选都比结果里最差的还差, 结束
+        if(c.score < results.top().score && (int)results.size() >= ef)
+            break;
+        candidates.pop();
+
+        for(int n : graph[c.row][level])
+        {
+            if(!visited.visit(n)) continue;
+            float s = similarity(query, data, n);
+            if((int)results.size() < ef || s > results.top().score)
+            {
+                candidates.push(Candidate{ s, n });
+                results.push(Candidate{ s, n });
+                if((int)results.size() > ef)
+                    results.pop();
+            }
+        }
+    }
+
+    std::vector<Candidate> out;
+    out.reserve(results.size());
+    while(!results.empty())
+    {
+        out.push_back(results.top());
+        results.pop();
+    }
+    std::reverse(out.begin(), out.end()); //相似度从高到低
+    return out;
+}
+
+//启发式选邻居: 候选离查询点比离已选邻居更近才保留, 让邻居分布在不同方向上
+std::vector<int> HnswIndex::select_neighbors(const FeatureMath::Rows &data,
+                                             std::vector<Candidate> &candidates, int maxLinks) const
+{
+    std::vector<int> selected;
+    std::vector<int> skipped;
+    for(const Candidate &c : candidates)
+    {
+        if((int)selected.size() >= maxLinks) break;
+        const float *v = data[c.row];
+        bool keep = true;
+        for(int s : selected)
+        {
+            if(similarity(v, data, s) > c.score)
+            {
+                keep = false;
+                break;
+            }
+        }
+        if(keep)
+            selected.push_back(c.row);
+        else
+            skipped.push_back(c.row);
+    }
+    //邻居不够时用被跳过的补齐, 保证连通
+    for(size_t i = 0; i < skipped.size() && (int)selected.size() < maxLinks; i++)
+        selected.push_back(skipped[i]);
+    return selected;
+}
+
+void HnswIndex::connect(int row, int level, const std::vector<int> &neighbors, const FeatureMath::Rows &data)
+{
+    links(row, level) = neighbors;
+    int maxLinks = max_links(level);
+
+    for(int n : neighbors)
+    {
+        std::vector<int> &nl = links(n, level);
+        nl.push_back(row);
+        if((int)nl.size() <= maxLinks) continue;
+
+        //邻居超过上限, 重新选
+        const float *nv = data[n];
+        std::vector<Candidate> cands;
+        cands.reserve(nl.size());
+        for(int m : nl)
+            cands.push_back(Candidate{ similarity(nv, data, m), m });
+        std::sort(cands.begin(), cands.end(), [](const Candidate &a, const Candidate &b){ return a.score > b.score; });
+        nl = select_neighbors(data, cands, maxLinks);
+    }
+}
+
+void HnswIndex::insert(int row, const FeatureMath::Rows &data)
+{
+    int level = random_level();
+    levels.push_back(level);
+    graph.emplace_back(level + 1);
+
+    if(entryPoint < 0)
+    {
+        entryPoint = row;
+        maxLevel = level;
+        return;
+    }
+
+    const float *v = data[row];
+    int entry = entryPoint;
+
+    //高于新节点层数的部分只做贪心下降
+    for(int l = maxLevel; l > level; l--)
+    {
+        bool changed = true;
+        float best = similarity(v, data, entry);
+        while(changed)
+        {
+            changed = false;
+            for(int n : graph[entry][l])
+            {
+                float s = similarity(v, data, n);
+                if(s > best)
+                {
+                    best = s;
+                    entry = n;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    for(int l = std::min(level, maxLevel); l >= 0; l--)
+    {
+        std::vector<Candidate> cands = search_layer(v, data, entry, param.efConstruction, l);
+        std::vector<int> neighbors = select_neighbors(data, cands, param.M);
+        connect(row, l, neighbors, data);
+        entry = cands.front().row;
+    }
+
+    if(level > maxLevel)
+    {
+        maxLevel = level;
+        entryPoint = row;
+    }
+}
+
+int HnswIndex::search(const float *query, const FeatureMath::Rows &data, int k, int *rows, float *scores, int ef) const
+{
+    if(entryPoint < 0 || k <= 0) return 0;
+    if(ef <= 0) ef = param.efSearch;
+    ef = std::max(ef, k);
+
+    int entry = entryPoint;
+    float best = similarity(query, data, entry);
+    for(int l = maxLevel; l > 0; l--)
+    {
+        bool changed = true;
+        while(changed)
+        {
+            changed = false;
+            for(int n : graph[entry][l])
+            {
+                float s = similarity(query, data, n);
+                if(s > best)
+                {
+                    best = s;
+                    entry = n;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    std::vector<Candidate> found = search_layer(query, data, entry, ef, 0);
+    int n = std::min(k, (int)found.size());
+    for(int i = 0; i < n; i++)
+    {
+        rows[i] = found[i].row;
+        scores[i] = found[i].score;
+    }
+    return n;
+}
@@ -0,0 +1,65 @@
+﻿#ifndef HNSWINDEX_H
+#define HNSWINDEX_H
+
+#include <vector>
+#include <random>
+#include <stddef.h>
+#include "featuremath.h"
+
+//HNSW 近似最近邻索引 (分层可导航小世界图)
+//索引只保存图结构, 节点编号就是特征库矩阵的行号, 特征数据在插入和查询时由调用方传入,
+//相似度用归一化特征的点积, 越大越相似
+//插入需要调用方加写锁, 查询只读, 多个线程可以同时查询
+
+class HnswIndex
+{
+public:
+    struct Params
+    {
+        Params() : M(16), efConstruction(200), efSearch(64) {}
+        int M;                  //每层每个节点的最大邻居数, 第0层为2M
+        int efConstruction;     //插入时的候选列表长度
+        int efSearch;           //查询时的候选列表长度, 越大召回越高越慢
+    };
+
+    explicit HnswIndex(const Params &params = Params());
+
+    void clear();
+    //插入第 row 行, 行号必须从0开始连续
+    void insert(int row, const FeatureMath::Rows &data);
+    //查找最相似的k行, 按相似度从高到低写入 rows/scores, ef<=0 时用 efSearch
+    int search(const float *query, const FeatureMath::Rows &data, int k, int *rows, float *scores, int ef = 0) const;
+
+    int size() const { return (int)levels.size(); }
+    const Params &params() const { return param; }
+    void set_ef(int ef) { param.efSearch = ef; }
+    //图结构占用的内存(字节)
+    size_t memory() const;
+
+private:
+    struct Candidate
+    {
+        float score;
+        int row;
+    };
+
+    std::vector<Candidate> search_layer(const float *query, const FeatureMath::Rows &data,
+                                        int entry, int ef, int level) const;
+    std::vector<int> select_neighbors(const FeatureMath::Rows &data,
+                                      std::vector<Candidate> &candidates, int maxLinks) const;
+    void connect(int row, int level, const std::vector<int> &neighbors, const FeatureMath::Rows &data);
+    std::vector<int> &links(int row, int level) { return graph[row][level]; }
+    int max_links(int level) const { return level == 0 ? 2 * param.M : param.M; }
+    int random_level();
+
+    Params param;
+    double levelMult;
+    std::mt19937 rng;
+
+    std::vector<int> levels;                            //每个节点的最高层
+    std::vector<std::vector<std::vector<int>>> graph;   //graph[行][层] = 邻居行号
+    int entryPoint;
+    int maxLevel;
+};
+
+#endif // HNSWINDEX_H
@@ -0,0 +1,112 @@
+﻿#include "identitycache.h"
+#include <QMutexLocker>
+#include <QDebug>
+
+//每查这么多次打印一次命中率
+static const int ReportInterval = 1000;
+
+IdentityCache::IdentityCache(int capacity, float threshold, int ttlMs)
+    : capacity(qMax(0, capacity)), threshold(threshold), ttlMs(ttlMs), galleryVersion(0), searchUs(0)
+{
+    clock.start();
+}
+
+//调用时已加锁
+void IdentityCache::reset_if_stale(quint64 version)
+{
+    if(version != galleryVersion)
+    {
+        entries.clear();
+        galleryVersion = version;
+    }
+}
+
+int64_t IdentityCache::lookup(const float *features, int dim, quint64 version, float *similarity)
+{
+    if(!enabled()) return -1;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QMutexLocker locker(&mutex);
+    reset_if_stale(version);
+    counters.lookups++;
+
+    //过期的条目在末尾, 先去掉
+    qint64 now = clock.elapsed();
+    while(!entries.isEmpty() && now - entries.last().usedMs > ttlMs)
+        entries.removeLast();
+
+    int best = -1;
+    float bestScore = threshold;
+    for(int i = 0; i < entries.size(); i++)
+    {
+        const Entry &e = entries[i];
+        if(e.features.size() != dim) continue;
+        float s = 0;
+        for(int d = 0; d < dim; d++)
+            s += features[d] * e.features[d];
+        if(s >= bestScore)
+        {
+            bestScore = s;
+            best = i;
+        }
+    }
+
+    int64_t faceid = -1;
+    if(best >= 0)
+    {
+        faceid = entries[best].faceid;
+        *similarity = bestScore;
+        counters.hits++;
+        counters.savedUs += qMax<qint64>(0, qint64(searchUs) - timer.nsecsElapsed() / 1000);
+    }
+
+    if(counters.lookups % ReportInterval == 0)
+    {
+        qDebug()<<"身份缓存命中率:"<<counters.hit_rate()<<"查询:"<<counters.lookups
+                <<"节省(ms):"<<counters.savedUs / 1000;
+    }
+    return faceid;
+}
+
+void IdentityCache::insert(int64_t faceid, const float *features, int dim, quint64 version)
+{
+    if(!enabled()) return;
+
+    QMutexLocker locker(&mutex);
+    reset_if_stale(version);
+
+    for(int i = 0; i < entries.size(); i++)
+    {
+        if(entries[i].faceid == faceid)
+        {
+            entries.remove(i);
+            break;
+        }
+    }
+    if(entries.size() >= capacity)
+        entries.removeLast();
+
+    Entry e;
+    e.faceid = faceid;
+    e.features = QVector<float>(features, features + dim);
+    e.usedMs = clock.elapsed();
+    entries.prepend(e);
+}
+
+void IdentityCache::record_search(qint64 us, int queries)
+{
+    if(!enabled() || queries <= 0) return;
+
+    QMutexLocker locker(&mutex);
+    //指数平均, 特征库变大时跟着变
+    double per = double(us) / queries;
+    searchUs = searchUs > 0 ? searchUs * 0.9 + per * 0.1 : per;
+}
+
+IdentityCache::Stats IdentityCache::stats() const
+{
+    QMutexLocker locker(&mutex);
+    return counters;
+}
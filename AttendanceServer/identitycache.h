@@ -0,0 +1,65 @@
+﻿#ifndef IDENTITYCACHE_H
+#define IDENTITYCACHE_H
+
+#include <QVector>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <stdint.h>
+
+//最近认出的人的缓存, 放在整库查找前面
+//同一个门口几秒内反复出现的总是那几个人(重试, 停留), 先和最近认出的几个人比较,
+//相似度足够高就直接返回, 不再扫整个特征库
+//缓存的是当时查询用的特征(同一台考勤机, 光线和角度接近), 命中时不更新, 避免特征一点点漂移
+//特征库有任何修改(注册, 删除, 更新)时清空, 不会返回已经删除或被新注册的人覆盖的结果
+//所有识别线程共用一个缓存, 考勤机被别的线程偷走时也能命中
+
+class IdentityCache
+{
+public:
+    //capacity为0表示不使用缓存; threshold是直接返回需要的相似度, 应高于识别阈值; ttlMs后条目过期
+    IdentityCache(int capacity, float threshold, int ttlMs);
+
+    bool enabled() const { return capacity > 0; }
+
+    //和缓存里的人比较, 命中返回faceid并写入相似度, 否则返回-1
+    //version是特征库当前版本, 和缓存的版本不同时先清空
+    int64_t lookup(const float *features, int dim, quint64 version, float *similarity);
+    //整库查找认出的人放进缓存, 已经在缓存里的替换特征
+    void insert(int64_t faceid, const float *features, int dim, quint64 version);
+    //记录一次整库查找的耗时, 用来估算命中省下的时间
+    void record_search(qint64 us, int queries);
+
+    struct Stats
+    {
+        quint64 lookups = 0;
+        quint64 hits = 0;
+        qint64 savedUs = 0;     //命中省下的整库查找时间(估算)
+        double hit_rate() const { return lookups ? double(hits) / lookups : 0; }
+    };
+    Stats stats() const;
+
+private:
+    struct Entry
+    {
+        int64_t faceid;
+        QVector<float> features;
+        qint64 usedMs;      //放进缓存的时间
+    };
+
+    //调用时已加锁
+    void reset_if_stale(quint64 version);
+
+    int capacity;
+    float threshold;
+    int ttlMs;
+
+    mutable QMutex mutex;
+    QVector<Entry> entries;     //最近放进来的在前面
+    quint64 galleryVersion;
+    QElapsedTimer clock;
+
+    double searchUs;            //整库查找每个查询的平均耗时
+    Stats counters;
+};
+
+#endif // IDENTITYCACHE_H
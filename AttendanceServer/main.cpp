@@ -8,6 +8,9 @@
 #include <QDebug>
 #include <opencv.hpp>
 #include "registerwin.h"
+#include "qfaceobject.h"
+#include <QFile>
+#include "serverconfig.h"
 
 int main(int argc, char *argv[])
 {
@@ -15,6 +18,7 @@ int main(int argc, char *argv[])
     qRegisterMetaType<cv::Mat>("cv::Mat&");
     qRegisterMetaType<cv::Mat>("cv::Mat");
     qRegisterMetaType<int64_t>("int64_t");
+    qRegisterMetaType<QVector<FaceMatch>>("QVector<FaceMatch>");
 
 //    RegisterWin ww;
 //    ww.show();
@@ -52,6 +56,57 @@ int main(int argc, char *argv[])
         return -1;
      }
 
+     // 创建特征库分区表格, 一个人可以属于多个分区(楼栋/部门)
+     createsql = "create table if not exists gallery_partition(name varchar(64), faceID integer, primary key(name, faceID))";
+
+     if(!query.exec(createsql))
+     {
+        qDebug() << "Partition Table Error:" << query.lastError().text();
+        return -1;
+     }
+
+     //旧版本用SeetaFace的face.db保存人脸, 新的特征库不存在时用员工头像重新提取特征
+     //换了识别模型(特征库文件按模型命名)后第一次启动时也一样
+     //打开级联识别后第一次启动时只生成小模型的特征库, 已有的大模型特征库不动
+     const ServerConfig &config = ServerConfig::get();
+     bool rebuildMain = !QFile::exists(config.galleryPath);
+     bool rebuildLight = !config.cascadeGalleryPath.isEmpty() && !QFile::exists(config.cascadeGalleryPath);
+     if(rebuildMain || rebuildLight)
+     {
+        QFaceObject fobj;
+        if(!fobj.usable())
+        {
+            return -1;
+        }
+        //小模型加载失败时没有小模型特征库
+        rebuildLight = rebuildLight && fobj.cascaded();
+        int imported = 0;
+        if(rebuildMain || rebuildLight)
+        {
+            query.exec("select faceID, headfile from employee where faceID >= 0");
+            while(query.next())
+            {
+                cv::Mat image = cv::imread(query.value(1).toString().toUtf8().data());
+                if(image.empty()) continue;
+                bool ok = rebuildMain ? fobj.face_import(image, query.value(0).toLongLong(), rebuildLight)
+                                      : fobj.face_import_light(image, query.value(0).toLongLong());
+                if(ok)
+                {
+                    imported++;
+                }
+            }
+        }
+        if(rebuildMain && !fobj.gallery()->compact_journal())
+        {
+            fobj.gallery()->save(config.galleryPath);
+        }
+        if(rebuildLight && !fobj.cascade_gallery()->compact_journal())
+        {
+            fobj.cascade_gallery()->save(config.cascadeGalleryPath);
+        }
+        qDebug() << (rebuildMain ? "从员工头像重建特征库:" : "从员工头像生成小模型特征库:") << imported;
+     }
+
      AttendanceWin w;
      w.show();
 
@@ -0,0 +1,45 @@
+﻿#include "matpool.h"
+#include <QDebug>
+
+MatPool::MatPool(int maxSlots)
+    : maxSlots(maxSlots), missCount(0)
+{
+    pool.reserve(maxSlots);
+}
+
+cv::Mat *MatPool::free_slot()
+{
+    for(int i = 0; i < pool.size(); i++)
+    {
+        cv::Mat &m = pool[i];
+        //识别线程用完会释放自己的引用, 这里读到1说明只有池子在用
+        //引用计数由其他线程原子递减, 读到旧值只会让这一帧跳过这个位置
+        if(m.u == nullptr || m.u->refcount == 1)
+            return &m;
+    }
+
+    if(pool.size() < maxSlots)
+    {
+        pool.append(cv::Mat());
+        return &pool.last();
+    }
+    return nullptr;
+}
+
+cv::Mat MatPool::decode(const char *data, int size, int flags)
+{
+    //只创建Mat头, 指向接收缓冲区里的jpg数据, 不拷贝
+    cv::Mat raw(1, size, CV_8UC1, (void*)data);
+
+    cv::Mat *slot = free_slot();
+    if(slot == nullptr)
+    {
+        //所有缓冲区都在识别线程手里, 这一帧单独分配
+        missCount++;
+        return cv::imdecode(raw, flags);
+    }
+
+    //尺寸和类型不变时 imdecode 直接写进已有的缓冲区
+    cv::imdecode(raw, flags, slot);
+    return *slot;
+}
@@ -0,0 +1,31 @@
+﻿#ifndef MATPOOL_H
+#define MATPOOL_H
+
+#include <QVector>
+#include <opencv.hpp>
+
+//解码后图像的内存池
+//考勤机发来的图片尺寸基本固定, 解码结果直接写进池里已经分配好的缓冲区,
+//cv::Mat 引用计数降回1(只剩池子自己持有)时这块内存就可以再次使用
+
+class MatPool
+{
+public:
+    explicit MatPool(int maxSlots = 16);
+
+    //直接从接收缓冲区解码, data 只在调用期间需要有效
+    cv::Mat decode(const char *data, int size, int flags = cv::IMREAD_COLOR);
+
+    int size() const { return pool.size(); }
+    //池子用完时额外分配的次数
+    quint64 misses() const { return missCount; }
+
+private:
+    cv::Mat *free_slot();
+
+    QVector<cv::Mat> pool;
+    int maxSlots;
+    quint64 missCount;
+};
+
+#endif // MATPOOL_H
@@ -1,57 +1,588 @@
 ﻿#include "qfaceobject.h"
+#include "serverconfig.h"
+#include "resultcache.h"
+#include "gallerypartitions.h"
 #include <QDebug>
+#include <QElapsedTimer>
+#include <algorithm>
 
-QFaceObject::QFaceObject(QObject *parent) : QObject(parent)
+//每识别这么多帧打印一次各步骤平均耗时
+static const int StageReportInterval = 100;
+
+//相似度超过这个值才认为是同一个人
+static const float MatchThreshold = 0.65f;
+
+//考勤机给出的人脸框最小边长, 太小的脸特征不可靠
+static const int MinHintSize = 40;
+
+QFaceObject::QFaceObject(QSharedPointer<FaceGallery> gallery, QObject *parent)
+    : QObject(parent), fgallery(gallery), cache(nullptr), resultCache(nullptr), partitionSet(nullptr), matched(false), stageFrames(0), stageFaces(0), hinted(0), hintRejected(0), embedded(0), gated(0), gateRejected(0),
+      cascadeFaces(0), escalated(0), lightUs(0), batches(0)
 {
-    //初始化
-    seeta::ModelSetting FDmode("E:/ARM_QT_opencv_item/SeetaFace/bin/model/fd_2_00.dat",seeta::ModelSetting::CPU,0);
-    seeta::ModelSetting PDmode("E:/ARM_QT_opencv_item/SeetaFace/bin/model/pd_2_00_pts5.dat",seeta::ModelSetting::CPU,0);
-    seeta::ModelSetting FRmode("E:/ARM_QT_opencv_item/SeetaFace/bin/model/fr_2_10.dat",seeta::ModelSetting::CPU,0);
+    //检测,关键点,特征提取分开创建, 每一步可以单独调用
+    engine = FaceModels::instance().acquire();
 
-    this->fengineptr = new seeta::FaceEngine(FDmode,PDmode,FRmode);
+    for(int i = 0; i < 4; i++) stageUs[i] = 0;
+    modeFaces[0] = modeFaces[1] = modeUs[0] = modeUs[1] = 0;
+    quality = ServerConfig::get().quality;
 
-    //导入已有的人脸数据库
-    this->fengineptr->Load("./face.db");
+    //导入已有的人脸特征库
+    const ServerConfig &config = ServerConfig::get();
+    if(fgallery.isNull())
+    {
+        fgallery = open_gallery(config.galleryPath, feature_size());
+        if(engine->light != nullptr)
+            set_cascade(open_gallery(config.cascadeGalleryPath, engine->light->feature_size()));
+    }
+    matched = fgallery->init(feature_size());
+    if(!matched)
+    {
+        qDebug()<<"特征库"<<config.galleryPath<<"维度"<<fgallery->dim()<<"和识别模型"<<feature_size()
+                <<"不一致, 删除特征库文件后重启可以从员工头像重建";
+    }
 }
 
-QFaceObject::~QFaceObject()
+QSharedPointer<FaceGallery> QFaceObject::open_gallery(const QString &path, int dim)
 {
-    delete fengineptr;
+    QSharedPointer<FaceGallery> gallery(new FaceGallery(dim));
+    gallery->load(path);
+    gallery->set_purge(ServerConfig::get().galleryPurgeRatio);
+    //临时创建的对象每条注册立即fsync, 合并交给识别线程池的特征库
+    gallery->open_journal(path, 0, 1, 0);
+    gallery->set_compact(ServerConfig::get().galleryInt8, ServerConfig::get().galleryRerank);
+    return gallery;
 }
 
-int64_t QFaceObject::face_register(cv::Mat &faceImage)
+void QFaceObject::set_cascade(QSharedPointer<FaceGallery> light)
 {
-    //把opencv的Mat数据转为seetaface的数据
-    SeetaImageData simage;
-    simage.data = faceImage.data;
-    simage.width = faceImage.cols;
-    simage.height = faceImage.rows;
-    simage.channels = faceImage.channels();
-    int64_t faceid =  this->fengineptr->Register(simage);//注册返回一个人脸id
-    if(faceid>=0){
-        fengineptr->Save("./face.db");
+    lgallery = light;
+    if(engine->light != nullptr && !lgallery.isNull() && !lgallery->init(engine->light->feature_size()))
+    {
+        qDebug()<<"小模型特征库维度"<<lgallery->dim()<<"和模型不一致, 不使用级联识别";
+        lgallery.clear();
     }
-    return faceid;
 }
 
-int QFaceObject::face_query(cv::Mat &faceImage)
+QFaceObject::~QFaceObject()
+{
+    FaceModels::instance().release(engine);
+}
+
+int QFaceObject::feature_size() const
+{
+    return engine->recognizer->feature_size();
+}
+
+SeetaImageData QFaceObject::to_seeta(const cv::Mat &image)
 {
     //把opencv的Mat数据转为seetaface的数据
     SeetaImageData simage;
-    simage.data = faceImage.data;
-    simage.width = faceImage.cols;
-    simage.height = faceImage.rows;
-    simage.channels = faceImage.channels();
-    float similarity=0;
-    int64_t faceid =  fengineptr->Query(simage,&similarity); //运算时间比较长
-    qDebug()<<"查询"<<faceid<<similarity;
-    if(similarity > 0.65)
-    {
-        emit send_faceid(faceid);
+    simage.data = image.data;
+    simage.width = image.cols;
+    simage.height = image.rows;
+    simage.channels = image.channels();
+    return simage;
+}
+
+std::vector<SeetaFaceInfo> QFaceObject::detect(const SeetaImageData &image)
+{
+    std::vector<SeetaFaceInfo> result = engine->detector->detect(image);
+    //最大的人脸排在前面
+    std::sort(result.begin(), result.end(), [](const SeetaFaceInfo &a, const SeetaFaceInfo &b){
+        return a.pos.width * a.pos.height > b.pos.width * b.pos.height;
+    });
+    return result;
+}
+
+std::vector<SeetaPointF> QFaceObject::landmark(const SeetaImageData &image, const SeetaRect &face)
+{
+    return engine->landmarker->mark(image, face);
+}
+
+bool QFaceObject::extract(const SeetaImageData &image, const SeetaPointF *points, float *features)
+{
+    if(!engine->recognizer->extract(image, points, features))
+        return false;
+    FaceGallery::normalize(features, feature_size());
+    return true;
+}
+
+int64_t QFaceObject::search(const float *features, float *similarity)
+{
+    if(!matched) return -1;
+    return fgallery->search(features, similarity);
+}
+
+QVector<QVector<FaceMatch>> QFaceObject::recognize(const QVector<cv::Mat> &images, int maxFaces, bool crops,
+                                                   const QVector<FaceHint> &hints,
+                                                   const QVector<QVector<float>> &embeddings,
+                                                   const QVector<QString> &partitions)
+{
+    QElapsedTimer total, stage;
+    total.start();
+    QVector<QVector<FaceMatch>> results(images.size());
+    if(!matched) return results;
+    int dim = feature_size();
+    int early = 0;  //小模型直接认出的人脸数
+    std::vector<float> features;
+    QVector<QPair<int, int>> owners;   //每个特征属于哪张图的第几个结果
+    std::vector<quint64> hashes;        //每个特征对应人脸的感知哈希, 查完后放进结果缓存
+    quint64 version = fgallery->version();
+    //这一批是否先用小模型
+    int mode = ServerConfig::get().cascadeMode;
+    bool cascade = cascaded() && (mode == ServerConfig::CascadeOn
+                                  || (mode == ServerConfig::CascadeCompare && batches++ % 2 == 0));
+
+    //只查分区的考勤机: 缓存和小模型是按整个特征库给出的结果, 不是分区成员时当作没命中
+    auto in_scope = [&](int i, int64_t faceid) -> bool
+    {
+        if(!partitionSet || !partitionSet->enabled() || i >= partitions.size()) return true;
+        return partitionSet->admits(partitions[i], faceid);
+    };
+
+    //一个人脸依次: 质量检查 -> 结果缓存 -> 小模型 -> 大模型提取特征, 前面有结果就不再往后
+    //full为false(裁好的人脸)时只提取特征; 提取特征失败返回false
+    auto process = [&](int i, const SeetaImageData &simage, const std::vector<SeetaPointF> &points, FaceMatch &m, bool full) -> bool
+    {
+        quint64 hash = 0;
+        if(full)
+        {
+            m.quality = gate(simage, m.box, points);
+            if(m.quality != FaceQuality::Ok)
+            {
+                results[i].append(m);
+                return true;
+            }
+            if(resultCache && resultCache->face_hash_enabled())
+            {
+                hash = ResultCache::face_hash(simage, m.box);
+                FaceMatch hit = m;
+                if(resultCache->lookup_face(hash, m.box, version, hit) && in_scope(i, hit.faceid))
+                {
+                    results[i].append(hit);
+                    return true;
+                }
+            }
+            if(cascade && (m.faceid = cascade_accept(simage, points, &m.similarity)) >= 0 && in_scope(i, m.faceid))
+            {
+                if(hash) resultCache->store_face(hash, m, version);
+                results[i].append(m);
+                early++;
+                return true;
+            }
+        }
+
+        features.resize(features.size() + dim);
+        QElapsedTimer heavy;
+        heavy.start();
+        bool ok = extract(simage, points.data(), features.data() + features.size() - dim);
+        stageUs[2] += heavy.nsecsElapsed() / 1000;
+        if(!ok)
+        {
+            features.resize(features.size() - dim);
+            return false;
+        }
+        owners.append(qMakePair(i, results[i].size()));
+        hashes.push_back(hash);
+        results[i].append(m);
+        return true;
+    };
+
+    for(int i = 0; i < images.size(); i++)
+    {
+        //考勤机已经提取好特征: 半精度传输, 重新归一化后直接查
+        if(i < embeddings.size() && !embeddings[i].isEmpty())
+        {
+            if(++embedded % StageReportInterval == 0)
+                qDebug()<<"考勤机直接发送特征的请求:"<<embedded;
+            if(embeddings[i].size() != dim) continue;
+            features.insert(features.end(), embeddings[i].begin(), embeddings[i].end());
+            FaceGallery::normalize(features.data() + features.size() - dim, dim);
+            FaceMatch m;
+            m.box = { 0, 0, 0, 0 };
+            m.score = 1;
+            owners.append(qMakePair(i, results[i].size()));
+            hashes.push_back(0);
+            results[i].append(m);
+            continue;
+        }
+
+        SeetaImageData simage = to_seeta(images[i]);
+        std::vector<SeetaFaceInfo> faces;
+
+        //考勤机已经找到人脸: 直接定位关键点提取特征, 失败时再整张图检测
+        if(i < hints.size() && hints[i].valid && !crops)
+        {
+            FaceMatch m;
+            std::vector<SeetaPointF> points;
+            m.score = 1;
+            stage.start();
+            bool accepted = accept_hint(simage, hints[i], m.box, points);
+            stageUs[1] += stage.nsecsElapsed() / 1000;
+            if(accepted && process(i, simage, points, m, true))
+                continue;
+        }
+
+        if(crops)
+        {
+            SeetaFaceInfo whole;
+            whole.pos = { 0, 0, simage.width, simage.height };
+            whole.score = 1;
+            faces.push_back(whole);
+        }else
+        {
+            stage.start();
+            faces = detect(simage);
+            stageUs[0] += stage.nsecsElapsed() / 1000;
+            if((int)faces.size() > maxFaces) faces.resize(maxFaces);
+        }
+
+        for(const SeetaFaceInfo &face : faces)
+        {
+            FaceMatch m;
+            m.box = face.pos;
+            m.score = face.score;
+            stage.start();
+            std::vector<SeetaPointF> points = landmark(simage, face.pos);
+            stageUs[1] += stage.nsecsElapsed() / 1000;
+            //裁好的人脸(导入)不检查质量
+            process(i, simage, points, m, !crops);
+        }
+    }
+
+    int n = owners.size();
+    std::vector<int64_t> ids(n);
+    std::vector<float> similarity(n);
+
+    //先和最近认出的人比较, 没命中的再一起查特征库
+    stage.start();
+    std::vector<int> misses;
+    for(int j = 0; j < n; j++)
+    {
+        const float *f = features.data() + (size_t)j * dim;
+        ids[j] = cache ? cache->lookup(f, dim, version, &similarity[j]) : -1;
+        if(ids[j] >= 0 && !in_scope(owners[j].first, ids[j])) ids[j] = -1;
+        if(ids[j] < 0) misses.push_back(j);
+    }
+
+    //查一组没命中的特征, 每组特征库只扫一遍; 写回ids和相似度, 返回达到阈值的个数
+    std::vector<float> batch;
+    auto search_group = [&](const FaceGallery &gallery, const std::vector<int> &group) -> int
+    {
+        int m = (int)group.size();
+        const float *queries = features.data();
+        //group按顺序排列, 个数等于n时就是全部特征
+        if(m < n)
+        {
+            batch.resize((size_t)m * dim);
+            for(int k = 0; k < m; k++)
+                std::copy_n(features.data() + (size_t)group[k] * dim, dim, batch.data() + (size_t)k * dim);
+            queries = batch.data();
+        }
+        std::vector<int64_t> groupIds(m);
+        std::vector<float> groupScores(m);
+        gallery.search_batch(queries, m, groupIds.data(), groupScores.data());
+
+        int matched = 0;
+        for(int k = 0; k < m; k++)
+        {
+            ids[group[k]] = groupIds[k];
+            similarity[group[k]] = groupScores[k];
+            if(groupIds[k] >= 0 && groupScores[k] > MatchThreshold)
+            {
+                matched++;
+                if(cache) cache->insert(groupIds[k], queries + (size_t)k * dim, dim, version);
+            }
+        }
+        return matched;
+    };
+
+    //先在考勤机所属的分区里查, 分区里没找到的再和其他没命中的一起查整个特征库
+    std::vector<int> global;
+    if(partitionSet && partitionSet->enabled())
+    {
+        QHash<QString, std::vector<int>> scoped;
+        for(int j : misses)
+        {
+            int i = owners[j].first;
+            if(i < partitions.size() && !partitions[i].isEmpty())
+                scoped[partitions[i]].push_back(j);
+            else
+                global.push_back(j);
+        }
+        for(QHash<QString, std::vector<int>>::const_iterator it = scoped.constBegin(); it != scoped.constEnd(); ++it)
+        {
+            const std::vector<int> &group = it.value();
+            QSharedPointer<FaceGallery> scope = partitionSet->gallery(it.key());
+            if(scope.isNull())
+            {
+                global.insert(global.end(), group.begin(), group.end());
+                continue;
+            }
+            partitionSet->record((int)group.size(), search_group(*scope, group));
+            if(!partitionSet->fallback()) continue;
+            for(int j : group)
+            {
+                if(ids[j] < 0 || similarity[j] <= MatchThreshold)
+                    global.push_back(j);
+            }
+        }
+        //按原来的顺序, 全部没命中时不用再复制特征
+        std::sort(global.begin(), global.end());
     }else
     {
-        emit send_faceid(-1);
+        global = misses;
+    }
+
+    if(!global.empty())
+    {
+        QElapsedTimer timer;
+        timer.start();
+        search_group(*fgallery, global);
+        if(cache) cache->record_search(timer.nsecsElapsed() / 1000, (int)global.size());
+    }
+    stageUs[3] += stage.nsecsElapsed() / 1000;
+
+    for(int j = 0; j < n; j++)
+    {
+        FaceMatch &m = results[owners[j].first][owners[j].second];
+        m.similarity = similarity[j];
+        m.faceid = (ids[j] >= 0 && similarity[j] > MatchThreshold) ? ids[j] : -1;
+        //只查分区时没认出的人可能在别的分区, 不放进缓存
+        if(hashes[j] && (m.faceid >= 0 || in_scope(owners[j].first, -1)))
+            resultCache->store_face(hashes[j], m, version);
+    }
+
+    int faces = 0;
+    for(const QVector<FaceMatch> &r : results)
+        faces += r.size();
+    report_stages(images.size(), faces);
+    if(cascaded()) report_cascade(cascade, total.nsecsElapsed() / 1000, n + early);
+    return results;
+}
+
+int64_t QFaceObject::cascade_accept(const SeetaImageData &image, const std::vector<SeetaPointF> &points, float *similarity)
+{
+    QElapsedTimer timer;
+    timer.start();
+    cascadeFaces++;
+
+    //小模型在小特征库里取前两名: 第一名足够像并且明显比第二名像才接受
+    int dim = engine->light->feature_size();
+    std::vector<float> features(dim);
+    int64_t ids[2];
+    float scores[2];
+    int found = 0;
+    if(engine->light->extract(image, points.data(), features.data()))
+    {
+        FaceGallery::normalize(features.data(), dim);
+        found = lgallery->search(features.data(), 2, ids, scores);
+    }
+    const ServerConfig &config = ServerConfig::get();
+    bool accept = found > 0 && scores[0] >= config.cascadeAccept
+               && (found < 2 || scores[0] - scores[1] >= config.cascadeMargin);
+    lightUs += timer.nsecsElapsed() / 1000;
+
+    if(!accept)
+    {
+        escalated++;
+        return -1;
+    }
+    *similarity = scores[0];
+    return ids[0];
+}
+
+//升级比例, 以及两种方式各自实测的吞吐量(每秒人脸数, 包括检测, 查找等全部步骤)
+//只用一种方式时另一种为0; 对比模式下两种方式轮流处理同样的负载
+void QFaceObject::report_cascade(bool cascade, qint64 totalUs, int faces)
+{
+    qint64 before = modeFaces[0] + modeFaces[1];
+    modeFaces[cascade] += faces;
+    modeUs[cascade] += totalUs;
+    if(before / StageReportInterval == (modeFaces[0] + modeFaces[1]) / StageReportInterval)
+        return;
+
+    double rate[2];
+    for(int i = 0; i < 2; i++)
+        rate[i] = modeUs[i] > 0 ? modeFaces[i] * 1e6 / modeUs[i] : 0.0;
+    qDebug()<<"级联识别 人脸:"<<cascadeFaces<<"交给大模型比例:"<<(cascadeFaces > 0 ? double(escalated) / cascadeFaces : 0.0)
+            <<"小模型每人脸(us):"<<(cascadeFaces > 0 ? lightUs / cascadeFaces : 0)
+            <<"每秒人脸数 级联:"<<rate[1]<<"只用大模型:"<<rate[0];
+}
+
+bool QFaceObject::accept_hint(const SeetaImageData &image, const FaceHint &hint, SeetaRect &face, std::vector<SeetaPointF> &points)
+{
+    hinted++;
+    if(hinted % StageReportInterval == 0)
+        qDebug()<<"考勤机人脸位置:"<<hinted<<"被拒绝:"<<hintRejected;
+
+    //框要在图内, 而且不能太小
+    QRect bounds(0, 0, image.width, image.height);
+    QRect box = hint.box.intersected(bounds);
+    bool ok = box.width() >= MinHintSize && box.height() >= MinHintSize
+           && box.width() * 2 >= hint.box.width() && box.height() * 2 >= hint.box.height();
+    if(ok)
+    {
+        face = { box.x(), box.y(), box.width(), box.height() };
+        if(hint.points.size() == 5)
+        {
+            points.resize(5);
+            for(int k = 0; k < 5; k++)
+                points[k] = { hint.points[k].x(), hint.points[k].y() };
+        }else
+        {
+            points = landmark(image, face);
+        }
+
+        //5点依次是左眼,右眼,鼻尖,左嘴角,右嘴角: 都要在框附近, 眼睛在鼻尖上面, 嘴角在鼻尖下面
+        QRectF near = QRectF(box).adjusted(-box.width() / 4.0, -box.height() / 4.0, box.width() / 4.0, box.height() / 4.0);
+        for(const SeetaPointF &p : points)
+            ok = ok && near.contains(p.x, p.y);
+        ok = ok && points.size() == 5 && points[0].x < points[1].x && points[3].x < points[4].x
+                && qMax(points[0].y, points[1].y) < points[2].y && points[2].y < qMin(points[3].y, points[4].y);
+    }
+    if(!ok) hintRejected++;
+    return ok;
+}
+
+FaceQuality::Reason QFaceObject::gate(const SeetaImageData &image, const SeetaRect &face, const std::vector<SeetaPointF> &points)
+{
+    if(points.size() < 5) return FaceQuality::Pose;
+    FaceQuality::Reason reason = FaceQuality::check(image, face, points.data(), quality);
+    if(reason != FaceQuality::Ok) gateRejected++;
+    if(++gated % StageReportInterval == 0)
+        qDebug()<<"质量检查人脸:"<<gated<<"不合格:"<<gateRejected;
+    return reason;
+}
+
+qint64 QFaceObject::warm_up(int runs)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    //固定种子的噪声图, 人脸框和关键点按典型的正脸位置给出, 不依赖检测结果
+    cv::Mat image(480, 640, CV_8UC3);
+    cv::RNG rng(20240601);
+    rng.fill(image, cv::RNG::UNIFORM, 0, 256);
+    SeetaImageData simage = to_seeta(image);
+    SeetaRect face = { 220, 140, 200, 200 };
+    std::vector<float> features(feature_size());
+
+    for(int i = 0; i < runs; i++)
+    {
+        detect(simage);
+        std::vector<SeetaPointF> points = landmark(simage, face);
+        extract(simage, points.data(), features.data());
+        float similarity = 0;
+        search(features.data(), &similarity);
+        if(cascaded()) cascade_accept(simage, points, &similarity);
+    }
+    //预热不算进级联的统计
+    cascadeFaces = escalated = lightUs = 0;
+    return timer.elapsed();
+}
+
+void QFaceObject::report_stages(int frames, int faces)
+{
+    qint64 before = stageFrames;
+    stageFrames += frames;
+    stageFaces += faces;
+    if(stageFrames == 0 || before / StageReportInterval == stageFrames / StageReportInterval) return;
+
+    qDebug()<<"每帧平均耗时(us) 检测:"<<stageUs[0] / stageFrames<<"关键点:"<<stageUs[1] / stageFrames
+            <<"特征:"<<stageUs[2] / stageFrames<<"查找:"<<stageUs[3] / stageFrames
+            <<"每帧人脸数:"<<double(stageFaces) / stageFrames;
+}
+
+//注册只需要前三步: 取最大的人脸提取特征
+bool QFaceObject::describe(const cv::Mat &faceImage, std::vector<float> &features, std::vector<float> *light)
+{
+    if(!matched) return false;
+    SeetaImageData simage = to_seeta(faceImage);
+    std::vector<SeetaFaceInfo> faces = detect(simage);
+    if(faces.empty()) return false;
+    std::vector<SeetaPointF> points = landmark(simage, faces[0].pos);
+    features.resize(feature_size());
+    if(!extract(simage, points.data(), features.data())) return false;
+
+    if(light != nullptr && cascaded())
+    {
+        int dim = engine->light->feature_size();
+        light->resize(dim);
+        if(!engine->light->extract(simage, points.data(), light->data())) return false;
+        FaceGallery::normalize(light->data(), dim);
+    }
+    return true;
+}
+
+bool QFaceObject::describe_light(const cv::Mat &faceImage, std::vector<float> &light)
+{
+    if(!cascaded()) return false;
+    SeetaImageData simage = to_seeta(faceImage);
+    std::vector<SeetaFaceInfo> faces = detect(simage);
+    if(faces.empty()) return false;
+    std::vector<SeetaPointF> points = landmark(simage, faces[0].pos);
+    int dim = engine->light->feature_size();
+    light.resize(dim);
+    if(!engine->light->extract(simage, points.data(), light.data())) return false;
+    FaceGallery::normalize(light.data(), dim);
+    return true;
+}
+
+int64_t QFaceObject::face_register(cv::Mat &faceImage)
+{
+    std::vector<float> features, light;
+    if(!describe(faceImage, features, &light)) return -1;
+
+    int64_t faceid = fgallery->add(features.data());//注册返回一个人脸id, 打开日志时已经写进日志
+    if(faceid>=0){
+        if(!light.empty()) lgallery->add(faceid, light.data());
+        persist();
     }
     return faceid;
 }
 
+//打开日志时修改已经写进日志, 否则保存整个特征库
+void QFaceObject::persist()
+{
+    if(!fgallery->journaled())
+        fgallery->save(ServerConfig::get().galleryPath);
+    if(!lgallery.isNull() && !lgallery->journaled())
+        lgallery->save(ServerConfig::get().cascadeGalleryPath);
+}
+
+bool QFaceObject::face_delete(int64_t faceid)
+{
+    if(!fgallery->remove(faceid)) return false;
+    if(!lgallery.isNull()) lgallery->remove(faceid);
+    persist();
+    return true;
+}
+
+bool QFaceObject::face_update(cv::Mat &faceImage, int64_t faceid)
+{
+    std::vector<float> features, light;
+    if(!describe(faceImage, features, &light)) return false;
+    if(!fgallery->update(faceid, features.data())) return false;
+    //小模型特征库里没有这个人时添加
+    if(!light.empty()) lgallery->add(faceid, light.data());
+    persist();
+    return true;
+}
+
+bool QFaceObject::face_import(cv::Mat &faceImage, int64_t faceid, bool withLight)
+{
+    std::vector<float> features, light;
+    if(!describe(faceImage, features, withLight ? &light : nullptr)) return false;
+    fgallery->add(faceid, features.data());
+    if(!light.empty()) lgallery->add(faceid, light.data());
+    return true;
+}
+
+bool QFaceObject::face_import_light(cv::Mat &faceImage, int64_t faceid)
+{
+    std::vector<float> light;
+    if(!describe_light(faceImage, light)) return false;
+    lgallery->add(faceid, light.data());
+    return true;
+}
@@ -2,26 +2,142 @@
 #define QFACEOBJECT_H
 
 #include <QObject>
-#include <seeta/FaceEngine.h>
+#include <QSharedPointer>
+#include <QVector>
+#include <QMetaType>
 #include <opencv.hpp>
+#include <vector>
+#include "facegallery.h"
+#include "facemodels.h"
+#include "frameparser.h"
+#include "identitycache.h"
+#include "facequality.h"
 
+class ResultCache;
+class GalleryPartitions;
+
+//批量识别里一个人脸的结果
+struct FaceMatch
+{
+    SeetaRect box;          //在原图中的位置
+    float score = 0;        //检测置信度
+    int64_t faceid = -1;    //相似度没有达到阈值时为-1
+    float similarity = 0;
+    int quality = FaceQuality::Ok;  //质量检查不合格时没有提取特征, faceid为-1
+};
+Q_DECLARE_METATYPE(FaceMatch)
 
 //人脸数据存储,人脸检测,人脸识别
+//模型从 FaceModels 借用, 对象析构时归还, 创建对象不会重新加载模型
 
 class QFaceObject : public QObject
 {
     Q_OBJECT
 public:
-    explicit QFaceObject(QObject *parent = nullptr);
+    //gallery为空时自己从文件导入特征库
+    explicit QFaceObject(QSharedPointer<FaceGallery> gallery = QSharedPointer<FaceGallery>(), QObject *parent = nullptr);
     ~QFaceObject();
+
+    //分步骤识别
+    //1.检测人脸, 按人脸大小从大到小排列
+    std::vector<SeetaFaceInfo> detect(const SeetaImageData &image);
+    //2.定位5点关键点
+    std::vector<SeetaPointF> landmark(const SeetaImageData &image, const SeetaRect &face);
+    //3.提取特征, features长度为feature_size(), 结果已归一化
+    bool extract(const SeetaImageData &image, const SeetaPointF *points, float *features);
+    //4.在特征库中查找
+    int64_t search(const float *features, float *similarity);
+
+    //批量识别: 每张图最多取maxFaces个人脸(从大到小), 所有人脸提取完特征后一起在特征库中查找
+    //质量不合格的人脸也在结果里, 带上原因, 不提取特征
+    //crops为true时每张图已经是裁好的人脸, 不再检测
+    //hints[i]有效时第i张图只识别考勤机给出的人脸, 不再检测; 位置不合理时退回到整张图检测
+    //embeddings[i]不为空时是考勤机提取好的特征, 第i张图不用处理, 维度不对时没有结果
+    //partitions[i]不为空时第i张图的人脸先在这个分区里找
+    QVector<QVector<FaceMatch>> recognize(const QVector<cv::Mat> &images, int maxFaces, bool crops = false,
+                                          const QVector<FaceHint> &hints = QVector<FaceHint>(),
+                                          const QVector<QVector<float>> &embeddings = QVector<QVector<float>>(),
+                                          const QVector<QString> &partitions = QVector<QString>());
+
+    //用合成图像把每个步骤跑几遍, 让模型的延迟初始化和特征库的页缓存在第一次真正查询之前完成
+    //返回总耗时(毫秒)
+    qint64 warm_up(int runs);
+
+    int feature_size() const;
+    //特征库的维度和识别模型一致; 不一致时识别没有结果, 注册失败, 不会读写错误长度的特征
+    bool usable() const { return matched; }
+    QSharedPointer<FaceGallery> gallery() const { return fgallery; }
+    //级联识别: 先用小模型在 light 特征库里找, 把握大时直接接受, 否则再用大模型
+    //没有配置小模型时不起作用; 注册, 删除和更新同时修改两个特征库
+    void set_cascade(QSharedPointer<FaceGallery> light);
+    QSharedPointer<FaceGallery> cascade_gallery() const { return lgallery; }
+    bool cascaded() const { return engine->light != nullptr && !lgallery.isNull(); }
+    //批量识别先查最近认出的人, 为空时每次都查整个特征库
+    void set_cache(IdentityCache *identities) { cache = identities; }
+    //按人脸感知哈希沿用上次的结果, 为空时不使用
+    void set_result_cache(ResultCache *results) { resultCache = results; }
+    //特征库分区, 为空时只查整个特征库
+    void set_partitions(GalleryPartitions *scopes) { partitionSet = scopes; }
+
+    static SeetaImageData to_seeta(const cv::Mat &image);
 public slots:
     int64_t face_register(cv::Mat& faceImage);
-    int face_query(cv::Mat& faceImage);
-signals:
-    void send_faceid(int64_t faceid);
+    //导入旧数据时按已有的faceID注册, withLight为false时不动小模型特征库(已经存在时)
+    bool face_import(cv::Mat& faceImage, int64_t faceid, bool withLight = true);
+    //只往小模型特征库导入, 大模型的特征库已经存在时用
+    bool face_import_light(cv::Mat& faceImage, int64_t faceid);
+    //删除faceID(员工离职), 不存在返回false
+    bool face_delete(int64_t faceid);
+    //用新照片替换faceID的特征
+    bool face_update(cv::Mat& faceImage, int64_t faceid);
 private:
-    seeta::FaceEngine  *fengineptr;
+    //累计一批识别的各步骤耗时, 每 StageReportInterval 帧打印一次平均值
+    void report_stages(int frames, int faces);
+    //light不为空并且打开了级联时同时提取小模型的特征
+    bool describe(const cv::Mat &faceImage, std::vector<float> &features, std::vector<float> *light = nullptr);
+    //只用小模型提取特征, 没有打开级联时返回false
+    bool describe_light(const cv::Mat &faceImage, std::vector<float> &light);
+    //小模型识别, 把握大时返回faceid, 否则返回-1, 需要大模型再识别
+    int64_t cascade_accept(const SeetaImageData &image, const std::vector<SeetaPointF> &points, float *similarity);
+    //按这一批是否用了级联分别累计实测的耗时和人脸数
+    void report_cascade(bool cascade, qint64 totalUs, int faces);
+    static QSharedPointer<FaceGallery> open_gallery(const QString &path, int dim);
+    //检查考勤机给出的人脸位置, 可以用时得到人脸框和关键点
+    bool accept_hint(const SeetaImageData &image, const FaceHint &hint, SeetaRect &face, std::vector<SeetaPointF> &points);
+    void persist();
+    //提取特征前检查人脸质量, 统计不合格的比例
+    FaceQuality::Reason gate(const SeetaImageData &image, const SeetaRect &face, const std::vector<SeetaPointF> &points);
+
+    FaceEngine *engine;
+    QSharedPointer<FaceGallery> fgallery;
+    QSharedPointer<FaceGallery> lgallery;
+    IdentityCache *cache;
+    ResultCache *resultCache;
+    GalleryPartitions *partitionSet;
+    bool matched;
 
+    //识别的帧数, 人脸数和各步骤(检测, 关键点, 特征, 查找)累计耗时, 定期打印平均值
+    qint64 stageFrames;
+    qint64 stageFaces;
+    qint64 stageUs[4];
+    //考勤机给出人脸位置的帧数和其中被拒绝的帧数
+    qint64 hinted;
+    qint64 hintRejected;
+    //考勤机直接发特征的请求数
+    qint64 embedded;
+    //质量检查的人脸数和其中不合格的
+    FaceQuality::Params quality;
+    qint64 gated;
+    qint64 gateRejected;
+    //级联: 经过小模型的人脸数, 其中交给大模型的, 小模型的累计耗时(微秒)
+    qint64 cascadeFaces;
+    qint64 escalated;
+    qint64 lightUs;
+    //识别的批数, 对比模式下单数批只用大模型
+    qint64 batches;
+    //两种方式各自识别的人脸数和总耗时(微秒), [0]只用大模型, [1]级联
+    qint64 modeFaces[2];
+    qint64 modeUs[2];
 };
 
 #endif // QFACEOBJECT_H
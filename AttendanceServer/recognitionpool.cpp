@@ -0,0 +1,151 @@
+﻿#include "recognitionpool.h"
+#include "serverconfig.h"
+#include <QDebug>
+
+RecognitionWorker::RecognitionWorker(int index, RecognitionQueue *queue, RecognitionPool *pool, QSharedPointer<FaceGallery> gallery)
+    : index(index), queue(queue), pool(pool), gallery(gallery)
+{
+}
+
+void RecognitionWorker::run()
+{
+    //模型在识别线程里加载, 多个线程同时加载
+    QFaceObject fobj(gallery);
+    //特征库和模型的维度不一致时查找和注册都会出错, 不报就绪, 服务器不开始监听
+    if(!fobj.usable())
+    {
+        qDebug()<<"识别线程"<<index<<"退出: 特征库和识别模型不匹配";
+        return;
+    }
+    fobj.set_cache(&pool->cache);
+    fobj.set_cascade(pool->lgallery);
+    fobj.set_result_cache(&pool->resultCache);
+    fobj.set_partitions(&pool->scopes);
+    const ServerConfig &config = ServerConfig::get();
+    qint64 warmMs = fobj.warm_up(config.warmupRuns);
+    qDebug()<<"识别线程"<<index<<"就绪, 预热耗时(ms):"<<warmMs;
+    pool->worker_ready();
+
+    //几个考勤机同时来的帧一起识别, 所有人脸的特征一起查特征库
+    QVector<RecognitionJob> jobs;
+    QVector<cv::Mat> images;
+    QVector<FaceHint> hints;
+    QVector<QVector<float>> embeddings;
+    QVector<QString> partitions;
+    while(queue->take_batch(index, jobs, config.batchSize))
+    {
+        for(const RecognitionJob &job : jobs)
+        {
+            images.append(job.image);
+            hints.append(job.hint);
+            embeddings.append(job.features);
+            partitions.append(job.partition);
+        }
+        //识别前的版本: 识别期间特征库变了, 放进缓存的结果马上作废
+        quint64 version = gallery->version();
+        QVector<QVector<FaceMatch>> results = fobj.recognize(images, config.maxFaces, false, hints, embeddings, partitions);
+        images.clear();
+        hints.clear();
+        embeddings.clear();
+        partitions.clear();
+
+        for(int i = 0; i < jobs.size(); i++)
+        {
+            if(jobs[i].frameKey != 0)
+                pool->resultCache.store_frame(jobs[i].frameKey, version, results[i]);
+            emit pool->send_faces(jobs[i].sessionid, results[i]);
+            queue->done(jobs[i].sessionid);
+        }
+        jobs.clear(); //尽快把图像缓冲区还给内存池
+    }
+}
+
+RecognitionPool::RecognitionPool(RecognitionQueue *queue, QObject *parent)
+    : QObject(parent), queue(queue), fgallery(new FaceGallery()),
+      cache(ServerConfig::get().cacheSize, ServerConfig::get().cacheThreshold, ServerConfig::get().cacheTtlMs),
+      resultCache(ServerConfig::get().resultCache),
+      scopes(fgallery),
+      readyWorkers(0)
+{
+    startup.start();
+    //特征库只导入一次, 所有识别线程共用
+    const ServerConfig &config = ServerConfig::get();
+    fgallery->load(config.galleryPath);
+    fgallery->set_purge(config.galleryPurgeRatio);
+    fgallery->open_journal(config.galleryPath, config.journalSyncMs, config.journalSyncBatch, config.journalCompactRecords);
+    fgallery->set_compact(config.galleryInt8, config.galleryRerank);
+    if(config.hnsw)
+    {
+        HnswIndex::Params params;
+        params.M = config.hnswM;
+        params.efConstruction = config.hnswEfConstruction;
+        params.efSearch = config.hnswEfSearch;
+        fgallery->set_index(true, params, config.hnswMinRows);
+
+        //按当前参数抽样检查召回率, 调 ef_search 时参考
+        if(config.hnswRecallSamples > 0)
+        {
+            double exactUs = 0, indexUs = 0;
+            double recall = fgallery->measure_recall(config.hnswRecallSamples, 10, 0, &exactUs, &indexUs);
+            qDebug()<<"HNSW召回率@10:"<<recall<<"精确查找(us):"<<exactUs<<"索引查找(us):"<<indexUs;
+        }
+    }
+
+    //分区成员在数据库里, 线程池在界面线程创建, 这里就能读
+    scopes.load();
+
+    //级联识别的小模型特征库, 维度等第一套模型加载后再确定
+    if(!config.lightModel.isEmpty())
+    {
+        lgallery = QSharedPointer<FaceGallery>(new FaceGallery());
+        lgallery->load(config.cascadeGalleryPath);
+        lgallery->set_purge(config.galleryPurgeRatio);
+        lgallery->open_journal(config.cascadeGalleryPath, config.journalSyncMs, config.journalSyncBatch, config.journalCompactRecords);
+        lgallery->set_compact(config.galleryInt8, config.galleryRerank);
+    }
+
+    for(int i = 0; i < queue->workers(); i++)
+    {
+        workers.append(new RecognitionWorker(i, queue, this, fgallery));
+    }
+}
+
+RecognitionPool::~RecognitionPool()
+{
+    stop();
+    qDeleteAll(workers);
+}
+
+int64_t RecognitionPool::face_register(cv::Mat &faceImage)
+{
+    //特征库和日志都是识别线程共用的, 注册后下一次查询就能识别
+    QFaceObject fobj(fgallery);
+    fobj.set_cascade(lgallery);
+    return fobj.face_register(faceImage);
+}
+
+//在识别线程中调用, 最后一个就绪的线程发出 ready
+void RecognitionPool::worker_ready()
+{
+    if(readyWorkers.fetchAndAddOrdered(1) + 1 == workers.size())
+    {
+        emit ready(startup.elapsed());
+    }
+}
+
+void RecognitionPool::start()
+{
+    for(RecognitionWorker *w : workers)
+    {
+        w->start();
+    }
+}
+
+void RecognitionPool::stop()
+{
+    queue->close();
+    for(RecognitionWorker *w : workers)
+    {
+        w->wait();
+    }
+}
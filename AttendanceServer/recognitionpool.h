@@ -0,0 +1,84 @@
+﻿#ifndef RECOGNITIONPOOL_H
+#define RECOGNITIONPOOL_H
+
+#include <QObject>
+#include <QThread>
+#include <QList>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include "recognitionqueue.h"
+#include "facegallery.h"
+#include "qfaceobject.h"
+#include "identitycache.h"
+#include "resultcache.h"
+#include "gallerypartitions.h"
+
+class RecognitionPool;
+
+//一个识别线程, 在线程里创建自己的 QFaceObject, 循环从队列取帧识别
+class RecognitionWorker : public QThread
+{
+public:
+    RecognitionWorker(int index, RecognitionQueue *queue, RecognitionPool *pool, QSharedPointer<FaceGallery> gallery);
+
+protected:
+    void run() override;
+
+private:
+    int index;
+    RecognitionQueue *queue;
+    RecognitionPool *pool;
+    QSharedPointer<FaceGallery> gallery;
+};
+
+//识别线程池, 线程数和队列的工作列表数一致
+class RecognitionPool : public QObject
+{
+    Q_OBJECT
+public:
+    explicit RecognitionPool(RecognitionQueue *queue, QObject *parent = nullptr);
+    ~RecognitionPool();
+
+    void start();
+    //关闭队列并等待所有识别线程退出
+    void stop();
+    int size() const { return workers.size(); }
+    //所有识别线程共用的特征库
+    QSharedPointer<FaceGallery> gallery() const { return fgallery; }
+    //级联识别小模型的特征库, 没有配置小模型时为空
+    QSharedPointer<FaceGallery> cascade_gallery() const { return lgallery; }
+    //所有识别线程共用的最近识别缓存, 界面状态栏从这里取命中率和节省的时间
+    const IdentityCache &identities() const { return cache; }
+    //识别结果缓存, 界面线程收到帧时先查
+    ResultCache &results() { return resultCache; }
+    //按门口划分的特征库分区, 界面线程收到帧时查考勤机所属的分区
+    const GalleryPartitions &partitions() const { return scopes; }
+
+    //在调用线程里注册人脸, 借一套空闲的模型提取特征, 直接写进识别线程正在用的特征库
+    int64_t face_register(cv::Mat &faceImage);
+    //把注册好的faceID加进分区, 识别线程下一次查询就按新的成员查
+    bool assign_partition(const QString &name, int64_t faceid) { return scopes.assign(name, faceid); }
+
+signals:
+    //在识别线程中发出, 连接到界面线程的对象时自动排队
+    //一帧里认出的所有人脸, 按人脸大小从大到小
+    void send_faces(quint64 sessionid, const QVector<FaceMatch> &faces);
+    //所有识别线程都加载完模型并预热完成, msecs为从创建线程池(开始导入特征库)算起的耗时
+    void ready(qint64 msecs);
+
+private:
+    friend class RecognitionWorker;
+    void worker_ready();
+
+    RecognitionQueue *queue;
+    QList<RecognitionWorker*> workers;
+    QSharedPointer<FaceGallery> fgallery;
+    QSharedPointer<FaceGallery> lgallery;
+    IdentityCache cache;
+    ResultCache resultCache;
+    GalleryPartitions scopes;
+    QElapsedTimer startup;
+    QAtomicInt readyWorkers;
+};
+
+#endif // RECOGNITIONPOOL_H
@@ -0,0 +1,174 @@
+﻿#include "recognitionqueue.h"
+#include <QDebug>
+
+RecognitionQueue::RecognitionQueue(int workers, int depth, int deadlineMs, QObject *parent)
+    : QObject(parent), depth(qMax(1, depth)), deadlineMs(deadlineMs), closed(false),
+      droppedCount(0), coalescedCount(0), stolenCount(0)
+{
+    lanes.resize(qMax(1, workers));
+    clock.start();
+}
+
+//调用时已加锁
+void RecognitionQueue::schedule(quint64 sessionid)
+{
+    lanes[home(sessionid)].enqueue(sessionid);
+    wakeup.wakeOne();
+}
+
+void RecognitionQueue::push(const RecognitionJob &job)
+{
+    bool replaced = false;
+    {
+        QMutexLocker locker(&mutex);
+        QQueue<RecognitionJob> &q = pending[job.sessionid];
+        bool idle = q.isEmpty();
+        if(q.size() >= depth)
+        {
+            //只保留最新的画面
+            q.dequeue();
+            coalescedCount++;
+            replaced = true;
+        }
+        q.enqueue(job);
+        q.last().enqueuedMs = clock.elapsed();
+
+        //正在识别的考勤机等 done() 时再排队
+        if(idle && !busy.contains(job.sessionid))
+            schedule(job.sessionid);
+    }
+
+    if(replaced) emit jobs_discarded(job.sessionid, 1);
+}
+
+//调用时已加锁
+bool RecognitionQueue::pop(int worker, RecognitionJob &job, QList<QPair<quint64, int>> &discarded, bool steal)
+{
+    qint64 now = clock.elapsed();
+    int n = lanes.size();
+
+    //先取自己的, 再从其他线程的队尾偷
+    for(int k = 0; k < (steal ? n : 1); k++)
+    {
+        QQueue<quint64> &lane = lanes[(worker + k) % n];
+        while(!lane.isEmpty())
+        {
+            quint64 sid = (k == 0) ? lane.takeFirst() : lane.takeLast();
+            QQueue<RecognitionJob> &q = pending[sid];
+
+            //排队太久的帧直接丢掉
+            int stale = 0;
+            while(!q.isEmpty() && now - q.head().enqueuedMs > deadlineMs)
+            {
+                q.dequeue();
+                stale++;
+            }
+            if(stale > 0)
+            {
+                droppedCount += stale;
+                discarded.append(qMakePair(sid, stale));
+            }
+
+            if(q.isEmpty())
+            {
+                pending.remove(sid);
+                continue;
+            }
+
+            job = q.dequeue();
+            if(q.isEmpty())
+                pending.remove(sid);
+            busy.insert(sid);
+            if(k != 0) stolenCount++;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool RecognitionQueue::take(int worker, RecognitionJob &job)
+{
+    QVector<RecognitionJob> jobs;
+    if(!take_batch(worker, jobs, 1)) return false;
+    job = jobs.first();
+    return true;
+}
+
+bool RecognitionQueue::take_batch(int worker, QVector<RecognitionJob> &jobs, int max)
+{
+    jobs.clear();
+    while(true)
+    {
+        QList<QPair<quint64, int>> discarded;
+        bool found = false;
+        bool stop = false;
+        {
+            QMutexLocker locker(&mutex);
+            //每个考勤机取出后就标记为识别中, 一批里不会有同一个考勤机的两帧
+            //第一帧可以偷, 之后只取自己列表里的, 不抢其他线程的活
+            RecognitionJob job;
+            while(jobs.size() < qMax(1, max) && pop(worker, job, discarded, jobs.isEmpty()))
+            {
+                jobs.append(job);
+                found = true;
+            }
+            if(!found && discarded.isEmpty())
+            {
+                if(closed)
+                    stop = true;
+                else
+                    wakeup.wait(&mutex);
+            }
+        }
+
+        for(const QPair<quint64, int> &d : discarded)
+        {
+            qDebug()<<"考勤机"<<d.first<<"丢弃超时帧"<<d.second;
+            emit jobs_discarded(d.first, d.second);
+        }
+        if(found) return true;
+        if(stop) return false;
+    }
+}
+
+void RecognitionQueue::done(quint64 sessionid)
+{
+    QMutexLocker locker(&mutex);
+    busy.remove(sessionid);
+    //识别期间又来了新帧
+    if(pending.contains(sessionid))
+        schedule(sessionid);
+}
+
+void RecognitionQueue::remove_session(quint64 sessionid)
+{
+    QMutexLocker locker(&mutex);
+    pending.remove(sessionid);
+    for(QQueue<quint64> &lane : lanes)
+        lane.removeOne(sessionid);
+}
+
+void RecognitionQueue::close()
+{
+    QMutexLocker locker(&mutex);
+    closed = true;
+    wakeup.wakeAll();
+}
+
+quint64 RecognitionQueue::dropped() const
+{
+    QMutexLocker locker(&mutex);
+    return droppedCount;
+}
+
+quint64 RecognitionQueue::coalesced() const
+{
+    QMutexLocker locker(&mutex);
+    return coalescedCount;
+}
+
+quint64 RecognitionQueue::stolen() const
+{
+    QMutexLocker locker(&mutex);
+    return stolenCount;
+}
@@ -0,0 +1,86 @@
+﻿#ifndef RECOGNITIONQUEUE_H
+#define RECOGNITIONQUEUE_H
+
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QQueue>
+#include <QVector>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QElapsedTimer>
+#include <opencv.hpp>
+#include "frameparser.h"
+
+//一帧等待识别的图像
+struct RecognitionJob
+{
+    quint64 sessionid;
+    cv::Mat image;
+    FaceHint hint;      //考勤机给出的人脸位置
+    QVector<float> features;    //考勤机提取好的特征, 不为空时没有图像, 只查特征库
+    quint64 frameKey = 0;       //jpg内容的哈希, 识别结果按它放进结果缓存, 0表示不缓存
+    QString partition;          //考勤机所属的特征库分区, 为空时只查整个特征库
+    qint64 enqueuedMs;  //入队时间, 由队列填写
+};
+
+//界面线程和识别线程之间的任务队列
+//每个考勤机最多排 depth 帧, 新帧到来时挤掉最旧的一帧(只识别最新的画面),
+//排队超过 deadlineMs 的帧人已经走了, 取出时直接丢弃
+//每个识别线程有自己的待处理列表, 考勤机固定分到一个线程, 自己的列表空了就去别的线程列表尾部偷任务;
+//同一个考勤机同时只在一个线程里识别, 保证回复顺序
+
+class RecognitionQueue : public QObject
+{
+    Q_OBJECT
+public:
+    explicit RecognitionQueue(int workers = 1, int depth = 1, int deadlineMs = 1500, QObject *parent = nullptr);
+
+    //放入一帧, 可以在任意线程调用
+    void push(const RecognitionJob &job);
+    //识别线程取下一帧, 没有任务时阻塞, 队列关闭后返回false
+    bool take(int worker, RecognitionJob &job);
+    //一次取多个考勤机的帧(最多max个), 至少有一帧才返回, 队列关闭后返回false
+    bool take_batch(int worker, QVector<RecognitionJob> &jobs, int max);
+    //识别线程处理完这个考勤机的一帧
+    void done(quint64 sessionid);
+    //考勤机断开, 丢掉它还没识别的帧
+    void remove_session(quint64 sessionid);
+    //关闭队列, 唤醒所有等待的识别线程
+    void close();
+
+    int workers() const { return lanes.size(); }
+
+    //超时丢弃的帧数
+    quint64 dropped() const;
+    //被新帧覆盖的帧数
+    quint64 coalesced() const;
+    //从其他线程偷来的任务数
+    quint64 stolen() const;
+
+signals:
+    //这些帧不会再有识别结果
+    void jobs_discarded(quint64 sessionid, int count);
+
+private:
+    int home(quint64 sessionid) const { return sessionid % lanes.size(); }
+    void schedule(quint64 sessionid);
+    bool pop(int worker, RecognitionJob &job, QList<QPair<quint64, int>> &discarded, bool steal = true);
+
+    int depth;
+    int deadlineMs;
+    QElapsedTimer clock;
+
+    mutable QMutex mutex;
+    QWaitCondition wakeup;
+    QHash<quint64, QQueue<RecognitionJob>> pending;
+    QVector<QQueue<quint64>> lanes;  //每个识别线程待处理的考勤机
+    QSet<quint64> busy;              //正在识别的考勤机
+    bool closed;
+
+    quint64 droppedCount;
+    quint64 coalescedCount;
+    quint64 stolenCount;
+};
+
+#endif // RECOGNITIONQUEUE_H
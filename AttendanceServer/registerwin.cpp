@@ -2,6 +2,8 @@
 #include "ui_registerwin.h"
 #include <QFileDialog>
 #include <qfaceobject.h>
+#include "recognitionpool.h"
+#include "gallerypartitions.h"
 #include <QSqlTableModel>
 #include <QSqlRecord>
 #include <QMessageBox>
@@ -48,6 +50,7 @@ void RegisterWin::on_resetBt_clicked()
     ui->birthdayEdit->setDate(QDate::currentDate());
     ui->addressEdit->clear();
     ui->phoneEdit->clear();
+    ui->partitionEdit->clear();
     ui->picFileEdit->clear();
 }
 
@@ -66,9 +69,16 @@ void RegisterWin::on_addpicBt_clicked()
 void RegisterWin::on_registerBt_clicked()
 {
     //1.通过照片,结合faceObject模块得到faceID
-    QFaceObject faceobj;
     cv::Mat image = cv::imread(ui->picFileEdit->text().toUtf8().data());
-    int faceID = faceobj.face_register(image);
+    qint64 faceID = -1;
+    if(service != nullptr)
+    {
+        faceID = service->face_register(image);
+    }else
+    {
+        QFaceObject faceobj;
+        faceID = faceobj.face_register(image);
+    }
     qDebug()<<faceID;
     //把头像保存到一个固定的路径下
     QString headfile = QString("./data/%1.jpg").arg(QString(ui->nameEdit->text().toUtf8().toBase64()));
@@ -96,6 +106,20 @@ void RegisterWin::on_registerBt_clicked()
         QMessageBox::information(this,"注册提示","注册成功");
         //提交
         model.submitAll();
+        //加进填写的分区, 只查分区的考勤机马上就能认出
+        if(faceID >= 0)
+        {
+            QStringList names = ui->partitionEdit->text().replace("，", ",").split(",");
+            for(QString name : names)
+            {
+                name = name.trimmed();
+                if(name.isEmpty()) continue;
+                if(service != nullptr)
+                    service->assign_partition(name, faceID);
+                else
+                    GalleryPartitions::store(name, faceID);
+            }
+        }
 
     }else
     {
@@ -4,6 +4,8 @@
 #include <QWidget>
 #include <opencv.hpp>
 
+class RecognitionPool;
+
 namespace Ui {
 class RegisterWin;
 }
@@ -17,6 +19,8 @@ public:
     ~RegisterWin();
 
     void timerEvent(QTimerEvent *e);
+    //注册交给正在运行的识别服务, 不设置时临时创建识别对象
+    void set_service(RecognitionPool *pool) { service = pool; }
 
 private slots:
     void on_resetBt_clicked();
@@ -34,6 +38,7 @@ private:
     int timerid = -1;
     cv::VideoCapture cap;
     cv::Mat image;
+    RecognitionPool *service = nullptr;
 };
 
 #endif // REGISTERWIN_H
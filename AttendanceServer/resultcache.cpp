@@ -0,0 +1,176 @@
+﻿#include "resultcache.h"
+#include <QMutexLocker>
+#include <QDebug>
+#include <opencv.hpp>
+
+//每查这么多次打印一次命中率
+static const int ReportInterval = 1000;
+
+ResultCache::ResultCache(const Params &params)
+    : params(params), galleryVersion(0), frameLookups(0), frameHits(0), faceLookups(0), faceHits(0)
+{
+    clock.start();
+}
+
+quint64 ResultCache::frame_key(const QByteArray &jpeg, const FaceHint &hint, const QString &partition)
+{
+    //两个不同种子的32位哈希拼成64位, Qt在x86上用CRC32指令计算, 一帧几十微秒
+    quint64 key = (quint64(qHash(jpeg, 0x9e3779b9u)) << 32) | qHash(jpeg, 0x85ebca6bu);
+    if(hint.valid)
+    {
+        key ^= quint64(qHash(hint.box.x())) * 31 + qHash(hint.box.y());
+        key ^= (quint64(qHash(hint.box.width())) * 31 + qHash(hint.box.height())) << 32;
+    }
+    if(!partition.isEmpty())
+        key ^= quint64(qHash(partition)) << 16;
+    return key;
+}
+
+//调用时已加锁
+void ResultCache::reset_if_stale(quint64 version)
+{
+    if(version != galleryVersion)
+    {
+        frames.clear();
+        faces.clear();
+        galleryVersion = version;
+    }
+}
+
+//调用时已加锁
+void ResultCache::report()
+{
+    if((frameLookups + faceLookups) % ReportInterval != 0) return;
+    qDebug()<<"结果缓存 整帧命中:"<<frameHits<<"/"<<frameLookups<<"人脸命中:"<<faceHits<<"/"<<faceLookups;
+}
+
+bool ResultCache::lookup_frame(quint64 key, quint64 version, QVector<FaceMatch> &result)
+{
+    if(!params.enabled) return false;
+
+    QMutexLocker locker(&mutex);
+    reset_if_stale(version);
+    frameLookups++;
+    report();
+
+    QHash<quint64, FrameEntry>::iterator it = frames.find(key);
+    if(it == frames.end()) return false;
+    if(clock.elapsed() - it.value().storedMs > params.ttlMs)
+    {
+        frames.erase(it);
+        return false;
+    }
+    result = it.value().faces;
+    frameHits++;
+    return true;
+}
+
+void ResultCache::store_frame(quint64 key, quint64 version, const QVector<FaceMatch> &result)
+{
+    if(!params.enabled) return;
+
+    QMutexLocker locker(&mutex);
+    reset_if_stale(version);
+    qint64 now = clock.elapsed();
+
+    //满了先清掉过期的, 还是满就去掉最旧的
+    if(frames.size() >= params.size && !frames.contains(key))
+    {
+        QHash<quint64, FrameEntry>::iterator oldest = frames.end();
+        for(QHash<quint64, FrameEntry>::iterator it = frames.begin(); it != frames.end();)
+        {
+            if(now - it.value().storedMs > params.ttlMs)
+            {
+                it = frames.erase(it);
+                continue;
+            }
+            if(oldest == frames.end() || it.value().storedMs < oldest.value().storedMs)
+                oldest = it;
+            ++it;
+        }
+        if(frames.size() >= params.size && oldest != frames.end())
+            frames.erase(oldest);
+    }
+
+    FrameEntry e;
+    e.faces = result;
+    e.storedMs = now;
+    frames.insert(key, e);
+}
+
+quint64 ResultCache::face_hash(const SeetaImageData &image, const SeetaRect &face)
+{
+    cv::Mat whole(image.height, image.width, CV_8UC(image.channels), image.data);
+    cv::Rect box = cv::Rect(face.x, face.y, face.width, face.height) & cv::Rect(0, 0, image.width, image.height);
+    if(box.width <= 0 || box.height <= 0) return 0;
+
+    cv::Mat small, gray;
+    cv::resize(whole(box), small, cv::Size(9, 8), 0, 0, cv::INTER_AREA);
+    if(small.channels() == 3)
+        cv::cvtColor(small, gray, cv::COLOR_BGR2GRAY);
+    else
+        gray = small;
+
+    quint64 hash = 0;
+    for(int y = 0; y < 8; y++)
+    {
+        const uchar *row = gray.ptr<uchar>(y);
+        for(int x = 0; x < 8; x++)
+            hash = (hash << 1) | (row[x] > row[x + 1] ? 1 : 0);
+    }
+    return hash;
+}
+
+//位置和大小都相差不到10%
+static bool same_place(const SeetaRect &a, const SeetaRect &b)
+{
+    int tol = qMax(1, qMax(a.width, a.height) / 10);
+    return qAbs(a.x - b.x) <= tol && qAbs(a.y - b.y) <= tol
+        && qAbs(a.width - b.width) <= tol && qAbs(a.height - b.height) <= tol;
+}
+
+bool ResultCache::lookup_face(quint64 hash, const SeetaRect &box, quint64 version, FaceMatch &match)
+{
+    if(!face_hash_enabled()) return false;
+
+    QMutexLocker locker(&mutex);
+    reset_if_stale(version);
+    faceLookups++;
+    report();
+
+    qint64 now = clock.elapsed();
+    //从最新的往前找, 过期的都在前面
+    for(int i = faces.size() - 1; i >= 0; i--)
+    {
+        const FaceEntry &e = faces[i];
+        if(now - e.storedMs > params.ttlMs)
+        {
+            faces.remove(0, i + 1);
+            break;
+        }
+        if(int(qPopulationCount(e.hash ^ hash)) <= params.faceHashDistance && same_place(e.match.box, box))
+        {
+            match.faceid = e.match.faceid;
+            match.similarity = e.match.similarity;
+            faceHits++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ResultCache::store_face(quint64 hash, const FaceMatch &match, quint64 version)
+{
+    if(!face_hash_enabled()) return;
+
+    QMutexLocker locker(&mutex);
+    reset_if_stale(version);
+    if(faces.size() >= params.size)
+        faces.remove(0);
+
+    FaceEntry e;
+    e.hash = hash;
+    e.match = match;
+    e.storedMs = clock.elapsed();
+    faces.append(e);
+}
@@ -0,0 +1,74 @@
+﻿#ifndef RESULTCACHE_H
+#define RESULTCACHE_H
+
+#include <QHash>
+#include <QVector>
+#include <QMutex>
+#include <QElapsedTimer>
+#include "qfaceobject.h"
+
+//识别结果缓存, 相同的画面不再识别
+//1.整帧: 考勤机超时或重连后会重发已经识别过的帧, 按jpg内容的哈希直接返回上次的结果, 不解码也不识别
+//2.人脸(可选): 没人走动时连续几帧几乎一样, 按人脸区域的感知哈希(dHash)找上次同一位置的人脸,
+//  汉明距离足够小就沿用上次的faceid, 不提取特征; 不同的人在同一位置也可能很接近, 默认关闭
+//条目超过ttl过期, 特征库版本变化(注册, 删除, 更新)后全部作废
+//所有识别线程和界面线程共用
+
+class ResultCache
+{
+public:
+    struct Params
+    {
+        bool enabled = true;
+        int size = 64;              //最多缓存的帧数和人脸数
+        int ttlMs = 3000;
+        bool faceHash = false;      //按人脸感知哈希缓存
+        int faceHashDistance = 4;   //64位哈希最多相差的位数
+    };
+
+    explicit ResultCache(const Params &params);
+
+    //jpg内容的哈希, hint是考勤机给出的人脸框(同一张图给的框不同, 结果也可能不同)
+    //不同分区的考勤机先查的人不同, 分区名也算进去
+    static quint64 frame_key(const QByteArray &jpeg, const FaceHint &hint, const QString &partition = QString());
+    bool lookup_frame(quint64 key, quint64 version, QVector<FaceMatch> &faces);
+    void store_frame(quint64 key, quint64 version, const QVector<FaceMatch> &faces);
+
+    //人脸区域缩小成9x8灰度图, 相邻像素比较得到64位哈希
+    static quint64 face_hash(const SeetaImageData &image, const SeetaRect &face);
+    bool face_hash_enabled() const { return params.enabled && params.faceHash; }
+    //位置和大小接近并且哈希接近的人脸, 找到时写入faceid和相似度
+    bool lookup_face(quint64 hash, const SeetaRect &box, quint64 version, FaceMatch &match);
+    void store_face(quint64 hash, const FaceMatch &match, quint64 version);
+
+private:
+    struct FrameEntry
+    {
+        QVector<FaceMatch> faces;
+        qint64 storedMs;
+    };
+    struct FaceEntry
+    {
+        quint64 hash;
+        FaceMatch match;
+        qint64 storedMs;
+    };
+
+    //以下调用时已加锁
+    void reset_if_stale(quint64 version);
+    void report();
+
+    Params params;
+    QMutex mutex;
+    QElapsedTimer clock;
+    quint64 galleryVersion;
+    QHash<quint64, FrameEntry> frames;
+    QVector<FaceEntry> faces;   //最近放进来的在后面
+
+    quint64 frameLookups;
+    quint64 frameHits;
+    quint64 faceLookups;
+    quint64 faceHits;
+};
+
+#endif // RESULTCACHE_H
@@ -0,0 +1,46 @@
+﻿#include "seetabackend.h"
+
+static seeta::ModelSetting setting(const QString &model)
+{
+    return seeta::ModelSetting(model.toLocal8Bit().toStdString(), seeta::ModelSetting::CPU, 0);
+}
+
+SeetaDetector::SeetaDetector(const QString &model, int threads)
+    : model(model), detector(setting(model))
+{
+    if(threads > 0)
+        detector.set(seeta::FaceDetector::PROPERTY_NUMBER_THREADS, threads);
+}
+
+std::vector<SeetaFaceInfo> SeetaDetector::detect(const SeetaImageData &image)
+{
+    SeetaFaceInfoArray faces = detector.detect(image);
+    return std::vector<SeetaFaceInfo>(faces.data, faces.data + faces.size);
+}
+
+SeetaLandmarker::SeetaLandmarker(const QString &model)
+    : model(model), landmarker(setting(model))
+{
+}
+
+std::vector<SeetaPointF> SeetaLandmarker::mark(const SeetaImageData &image, const SeetaRect &face)
+{
+    std::vector<SeetaPointF> points(landmarker.number());
+    landmarker.mark(image, face, points.data());
+    return points;
+}
+
+SeetaRecognizer::SeetaRecognizer(const QString &model)
+    : model(model), recognizer(setting(model))
+{
+}
+
+int SeetaRecognizer::feature_size() const
+{
+    return recognizer.GetExtractFeatureSize();
+}
+
+bool SeetaRecognizer::extract(const SeetaImageData &image, const SeetaPointF *points, float *features)
+{
+    return recognizer.Extract(image, points, features);
+}
@@ -0,0 +1,49 @@
+﻿#ifndef SEETABACKEND_H
+#define SEETABACKEND_H
+
+#include "facebackend.h"
+#include <seeta/FaceDetector.h>
+#include <seeta/FaceLandmarker.h>
+#include <seeta/FaceRecognizer.h>
+
+//SeetaFace2的实现, 模型文件是 .dat
+
+class SeetaDetector : public FaceDetectorBackend
+{
+public:
+    //threads为0时用SeetaFace默认的线程数
+    SeetaDetector(const QString &model, int threads = 0);
+    QString name() const override { return "seeta(" + model + ")"; }
+    std::vector<SeetaFaceInfo> detect(const SeetaImageData &image) override;
+
+private:
+    QString model;
+    seeta::FaceDetector detector;
+};
+
+class SeetaLandmarker : public FaceLandmarkerBackend
+{
+public:
+    explicit SeetaLandmarker(const QString &model);
+    QString name() const override { return "seeta(" + model + ")"; }
+    std::vector<SeetaPointF> mark(const SeetaImageData &image, const SeetaRect &face) override;
+
+private:
+    QString model;
+    seeta::FaceLandmarker landmarker;
+};
+
+class SeetaRecognizer : public FaceRecognizerBackend
+{
+public:
+    explicit SeetaRecognizer(const QString &model);
+    QString name() const override { return "seeta(" + model + ")"; }
+    int feature_size() const override;
+    bool extract(const SeetaImageData &image, const SeetaPointF *points, float *features) override;
+
+private:
+    QString model;
+    seeta::FaceRecognizer recognizer;
+};
+
+#endif // SEETABACKEND_H
@@ -0,0 +1,94 @@
+﻿#include "serverconfig.h"
+#include <QSettings>
+#include <QThread>
+#include <QDebug>
+#include "faceembedding.h"
+#include "facegallery.h"
+#include <QFileInfo>
+
+ServerConfig::ServerConfig()
+{
+    QSettings ini("./server.ini", QSettings::IniFormat);
+
+    //每个识别线程都要加载一份模型, 默认不超过4个
+    int cores = qMax(1, QThread::idealThreadCount());
+    workers = qMax(1, ini.value("recognition/workers", qMin(cores, 4)).toInt());
+    queueDepth = qMax(1, ini.value("recognition/queue_depth", 1).toInt());
+    queueDeadlineMs = ini.value("recognition/queue_deadline_ms", 1500).toInt();
+    warmupRuns = qMax(0, ini.value("recognition/warmup_runs", 2).toInt());
+    batchSize = qMax(1, ini.value("recognition/batch_size", 4).toInt());
+    maxFaces = qMax(1, ini.value("recognition/max_faces", 5).toInt());
+    cacheSize = qMax(0, ini.value("recognition/cache_size", 16).toInt());
+    cacheThreshold = ini.value("recognition/cache_threshold", 0.75).toFloat();
+    cacheTtlMs = ini.value("recognition/cache_ttl_ms", 10000).toInt();
+    lightModel = ini.value("recognition/light_model", "").toString();
+    if(!lightModel.isEmpty())
+        cascadeGalleryPath = "./face_light_" + QFileInfo(lightModel).completeBaseName() + ".gallery";
+    cascadeAccept = ini.value("recognition/cascade_accept", 0.7).toFloat();
+    cascadeMargin = ini.value("recognition/cascade_margin", 0.1).toFloat();
+    QString mode = ini.value("recognition/cascade_mode", "cascade").toString();
+    cascadeMode = mode == "single" ? CascadeOff : mode == "compare" ? CascadeCompare : CascadeOn;
+
+    galleryInt8 = ini.value("gallery/int8", false).toBool();
+    galleryRerank = qMax(1, ini.value("gallery/rerank", 16).toInt());
+    hnsw = ini.value("gallery/hnsw", false).toBool();
+    hnswM = qMax(2, ini.value("gallery/hnsw_m", 16).toInt());
+    hnswEfConstruction = qMax(hnswM, ini.value("gallery/hnsw_ef_construction", 100).toInt());
+    hnswEfSearch = qMax(1, ini.value("gallery/hnsw_ef_search", 64).toInt());
+    hnswMinRows = ini.value("gallery/hnsw_min_rows", 5000).toInt();
+    hnswRecallSamples = ini.value("gallery/hnsw_recall_samples", 0).toInt();
+    journalSyncMs = ini.value("gallery/journal_sync_ms", 100).toInt();
+    journalSyncBatch = qMax(1, ini.value("gallery/journal_sync_batch", 32).toInt());
+    journalCompactRecords = ini.value("gallery/journal_compact_records", 1000).toInt();
+    galleryPurgeRatio = ini.value("gallery/purge_ratio", 0.2).toDouble();
+
+    detectorModel = ini.value("backend/detector_model", "E:/ARM_QT_opencv_item/SeetaFace/bin/model/fd_2_00.dat").toString();
+    landmarkerModel = ini.value("backend/landmarker_model", "E:/ARM_QT_opencv_item/SeetaFace/bin/model/pd_2_00_pts5.dat").toString();
+    recognizerModel = ini.value("backend/recognizer_model", "E:/ARM_QT_opencv_item/SeetaFace/bin/model/fr_2_10.dat").toString();
+    backendThreads = qMax(0, ini.value("backend/threads", 0).toInt());
+    embeddingModel = FaceEmbedding::model_id(recognizerModel);
+    galleryPath = QFileInfo(recognizerModel).fileName().toLower() == "fr_2_10.dat"
+            ? QString(FaceGallery::DefaultPath) : "./face_" + QFileInfo(recognizerModel).completeBaseName() + ".gallery";
+    //SSD检测模型一般是300x300的BGR输入
+    dnnDetector.inputSize = 300;
+    dnnDetector.swapRB = false;
+    for(DnnParams *p : { &dnnDetector, &dnnRecognizer })
+    {
+        QString group = (p == &dnnDetector) ? "dnn_detector/" : "dnn_recognizer/";
+        p->inputSize = qMax(16, ini.value(group + "input_size", p->inputSize).toInt());
+        p->scale = ini.value(group + "scale", p->scale).toDouble();
+        p->mean = ini.value(group + "mean", p->mean).toDouble();
+        p->swapRB = ini.value(group + "swap_rb", p->swapRB).toBool();
+        p->score = ini.value(group + "score", p->score).toFloat();
+    }
+
+    resultCache.enabled = ini.value("result_cache/enabled", resultCache.enabled).toBool();
+    resultCache.size = qMax(1, ini.value("result_cache/size", resultCache.size).toInt());
+    resultCache.ttlMs = ini.value("result_cache/ttl_ms", resultCache.ttlMs).toInt();
+    resultCache.faceHash = ini.value("result_cache/face_hash", resultCache.faceHash).toBool();
+    resultCache.faceHashDistance = ini.value("result_cache/face_hash_distance", resultCache.faceHashDistance).toInt();
+
+    quality.enabled = ini.value("quality/enabled", quality.enabled).toBool();
+    quality.minFace = ini.value("quality/min_face", quality.minFace).toInt();
+    quality.minSharpness = ini.value("quality/min_sharpness", quality.minSharpness).toDouble();
+    quality.minBrightness = ini.value("quality/min_brightness", quality.minBrightness).toInt();
+    quality.maxBrightness = ini.value("quality/max_brightness", quality.maxBrightness).toInt();
+    quality.maxYaw = ini.value("quality/max_yaw", quality.maxYaw).toDouble();
+    quality.maxRoll = ini.value("quality/max_roll", quality.maxRoll).toDouble();
+
+    ini.beginGroup("doors");
+    for(const QString &address : ini.childKeys())
+    {
+        doors.insert(address, ini.value(address).toString());
+    }
+    ini.endGroup();
+    partitionFallback = ini.value("partitions/fallback", true).toBool();
+
+    qDebug()<<"识别线程数:"<<workers<<"队列深度:"<<queueDepth<<"超时(ms):"<<queueDeadlineMs;
+}
+
+const ServerConfig &ServerConfig::get()
+{
+    static ServerConfig config;
+    return config;
+}
@@ -0,0 +1,76 @@
+﻿#ifndef SERVERCONFIG_H
+#define SERVERCONFIG_H
+
+#include <QString>
+#include <QHash>
+#include "facequality.h"
+#include "dnnbackend.h"
+#include "resultcache.h"
+
+//服务器参数, 从运行目录下的 server.ini 读取, 文件或配置项不存在时用默认值
+
+struct ServerConfig
+{
+    //配置了小模型时的识别方式: 级联; 只用大模型(小模型特征库照常维护); 两种方式轮流, 对比实测吞吐量
+    enum CascadeMode { CascadeOn, CascadeOff, CascadeCompare };
+
+    //[recognition]
+    int workers;          //识别线程数, 每个线程一套模型
+    int queueDepth;       //每个考勤机最多排队的帧数
+    int queueDeadlineMs;  //排队超过这个时间的帧直接丢弃
+    int warmupRuns;       //启动时每个识别线程用合成图像预热的次数
+    int batchSize;        //识别线程一次最多取几个考勤机的帧一起识别
+    int maxFaces;         //每帧最多识别的人脸数, 从大到小
+    int cacheSize;        //最近认出的人缓存多少个, 0不使用缓存
+    float cacheThreshold; //和缓存的人相似度达到这个值直接返回, 不查特征库
+    int cacheTtlMs;       //缓存的人超过这个时间没有再放进来就过期
+    QString lightModel;   //级联识别第一级的小模型文件, 为空时只用 fr_2_10 识别
+    float cascadeAccept;  //小模型第一名相似度达到这个值,
+    float cascadeMargin;  //并且比第二名高出这么多时直接接受, 否则再用大模型识别
+    int cascadeMode;      //CascadeMode, server.ini 里写 cascade / single / compare
+
+    //[gallery]
+    bool galleryInt8;     //特征库用int8扫描, 浮点重排
+    int galleryRerank;    //int8模式下浮点重排的候选数
+    bool hnsw;            //使用HNSW近似索引
+    int hnswM;            //每个节点的邻居数
+    int hnswEfConstruction;
+    int hnswEfSearch;     //查询候选数, 越大越准越慢
+    int hnswMinRows;      //人数达到这个值才走索引
+    int hnswRecallSamples;//启动时抽样检查召回率的查询数, 0不检查
+    int journalSyncMs;    //注册日志fsync间隔
+    int journalSyncBatch; //攒够这么多条注册立即fsync
+    int journalCompactRecords; //日志达到这么多条时合并进特征库文件
+    double galleryPurgeRatio;  //已删除的行占到这个比例时重建特征矩阵, 0不自动重建
+
+    //[backend] 模型文件, .onnx 用OpenCV DNN运行, 其他用SeetaFace
+    QString detectorModel;
+    QString landmarkerModel;  //只支持SeetaFace
+    QString recognizerModel;
+    int backendThreads;       //推理线程数, 0用库的默认值; OpenCV DNN是进程全局的
+    int embeddingModel;       //识别模型的编号, 考勤机发来的特征必须是同一个模型, 见 faceembedding.h
+    //每个识别模型一个特征库文件, 不同模型的特征维度不同, 不能放在一起; 换模型后第一次启动时从员工头像重建
+    QString galleryPath;        //fr_2_10 沿用 face.gallery
+    QString cascadeGalleryPath; //级联小模型的特征库, faceID和主特征库一致; 没有配置小模型时为空
+    //[dnn_detector] [dnn_recognizer] ONNX模型的输入参数, 级联的小模型是 .onnx 时也用识别的参数
+    DnnParams dnnDetector;
+    DnnParams dnnRecognizer;
+
+    //[result_cache]
+    ResultCache::Params resultCache;  //相同画面直接返回上次的识别结果
+
+    //[quality]
+    FaceQuality::Params quality;  //提取特征前的人脸质量检查
+
+    //[doors] 考勤机IP = 分区名, 分区成员在数据库的 gallery_partition 表
+    QHash<QString, QString> doors;
+    //[partitions]
+    bool partitionFallback;   //分区里没找到时再查整个特征库
+
+    static const ServerConfig &get();
+
+private:
+    ServerConfig();
+};
+
+#endif // SERVERCONFIG_H
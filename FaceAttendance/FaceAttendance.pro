@@ -20,6 +20,8 @@ INCLUDEPATH += E:\ARM_QT_opencv_item\SeetaFace\include
 INCLUDEPATH += E:\ARM_QT_opencv_item\SeetaFace\include\seeta
 INCLUDEPATH += E:\ARM_QT_opencv_item\opencv452\include
 INCLUDEPATH += E:\ARM_QT_opencv_item\opencv452\include\opencv2
+#和服务器共用的特征编码
+INCLUDEPATH += ../AttendanceServer
 
 #添加opencv,seetaface 库
 
@@ -30,10 +32,12 @@ LIBS+=E:\ARM_QT_opencv_item\SeetaFace\lib\libSeeta*
 
 SOURCES += \
     main.cpp \
-    faceattendance.cpp
+    faceattendance.cpp \
+    ../AttendanceServer/faceembedding.cpp
 
 HEADERS += \
-    faceattendance.h
+    faceattendance.h \
+    ../AttendanceServer/faceembedding.h
 
 FORMS += \
     faceattendance.ui
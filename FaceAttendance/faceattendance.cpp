@@ -16,14 +16,38 @@
 #include <QDate>
 #include <QTime>
 
+#include "faceembedding.h"
+
 static int faceStillCount = 0; // 连续检测到人脸的次数
 static bool hasSent = false;
 
+// CPU有余量的考勤机打开, 在本机提取特征只发送特征(约2KB), 不再发送图片
+static const bool EmbeddingMode = false;
+// 特征提取模型, 服务器按模型文件核对编号(见 faceembedding.h), 必须和服务器的一致
+static const char *RecognizerModel = "E:/ARM_QT_opencv_item/SeetaFace/bin/model/fr_2_10.dat";
+
 FaceAttendance::FaceAttendance(QWidget *parent)
-    : QMainWindow(parent), ui(new Ui::FaceAttendance)
+    : QMainWindow(parent), ui(new Ui::FaceAttendance), sendEmbedding(false), embeddingModel(FaceEmbedding::Model), landmarker(nullptr), recognizer(nullptr)
 {
     ui->setupUi(this);
 
+    if (EmbeddingMode)
+    {
+        seeta::ModelSetting PDmode("E:/ARM_QT_opencv_item/SeetaFace/bin/model/pd_2_00_pts5.dat", seeta::ModelSetting::CPU, 0);
+        seeta::ModelSetting FRmode(RecognizerModel, seeta::ModelSetting::CPU, 0);
+        try
+        {
+            landmarker = new seeta::FaceLandmarker(PDmode);
+            recognizer = new seeta::FaceRecognizer(FRmode);
+            embeddingModel = FaceEmbedding::model_id(RecognizerModel);
+            sendEmbedding = true;
+        }
+        catch (const std::exception &e)
+        {
+            qDebug() << "特征模型加载失败, 改为发送图片:" << e.what();
+        }
+    }
+
     serial = new QSerialPort(this);
     serial->setPortName("COM5");                  // 改成你实际使用的串口号
     serial->setBaudRate(QSerialPort::Baud115200); // 或9600，根据 STM32 设置
@@ -75,6 +99,8 @@ FaceAttendance::FaceAttendance(QWidget *parent)
 
 FaceAttendance::~FaceAttendance()
 {
+    delete landmarker;
+    delete recognizer;
     delete ui;
 }
 
@@ -98,6 +124,25 @@ void FaceAttendance::recv_data()
     }
 
     QJsonObject obj = doc.object();
+
+    // 服务器不接受这个模型或版本的特征, 改回发送图片, 人脸还在时重新发一次
+    if (obj.value("error").toString() == "embedding_version")
+    {
+        qDebug() << "服务器特征格式不一致, 改为发送图片";
+        sendEmbedding = false;
+        hasSent = false;
+        return;
+    }
+
+    // 人脸质量不合格(模糊, 太小, 太暗太亮, 侧脸), 等几帧后换一帧重新发送
+    QString quality = obj.value("quality").toString();
+    if (!quality.isEmpty())
+    {
+        qDebug() << "人脸质量不合格:" << quality;
+        faceStillCount = 0;
+        hasSent = false;
+        return;
+    }
     QString employeeID = obj.value("employeeID").toString();
     QString name = obj.value("name").toString(); // 仍然接收name用于UI显示和判断未知用户
     QString department = obj.value("department").toString();
@@ -308,6 +353,28 @@ void FaceAttendance::processMjpegStreamData()
     }
 }
 
+bool FaceAttendance::extractEmbedding(const cv::Mat &image, const cv::Rect &rect, QByteArray &embedding)
+{
+    SeetaImageData simage;
+    simage.data = image.data;
+    simage.width = image.cols;
+    simage.height = image.rows;
+    simage.channels = image.channels();
+
+    // 在Haar找到的人脸框里定位5点关键点, 再提取特征
+    SeetaRect face = {rect.x, rect.y, rect.width, rect.height};
+    std::vector<SeetaPointF> points(landmarker->number());
+    landmarker->mark(simage, face, points.data());
+
+    std::vector<float> features(recognizer->GetExtractFeatureSize());
+    if (!recognizer->Extract(simage, points.data(), features.data()))
+    {
+        return false;
+    }
+    embedding = FaceEmbedding::encode(features.data(), int(features.size()), embeddingModel);
+    return true;
+}
+
 void FaceAttendance::processJpegFrame(const QByteArray &jpegData)
 {
     // 将JPEG数据转换为OpenCV格式
@@ -345,11 +412,26 @@ void FaceAttendance::processJpegFrame(const QByteArray &jpegData)
 
             if (faceStillCount >= 5 && !hasSent)
             {
-                // 发送逻辑（与之前相同）
-                std::vector<uchar> buf;
-                cv::imencode(".jpg", srcImage, buf);
-                QByteArray byte((const char *)buf.data(), buf.size());
-                quint64 backsize = byte.size();
+                QByteArray byte;
+                quint64 backsize;
+                if (sendEmbedding && extractEmbedding(srcImage, rect, byte))
+                {
+                    // 最高字节是消息类型, 2表示只有特征
+                    backsize = (quint64(2) << 56) | quint64(byte.size());
+                }
+                else
+                {
+                    std::vector<uchar> buf;
+                    cv::imencode(".jpg", srcImage, buf);
+                    // 带上已检测到的人脸框, 服务器可以跳过人脸检测
+                    // 格式: qint32 x,y,w,h + quint32 关键点数(这里没有关键点, 为0) + jpg数据
+                    QDataStream hint(&byte, QIODevice::WriteOnly);
+                    hint.setVersion(QDataStream::Qt_5_14);
+                    hint << qint32(rect.x) << qint32(rect.y) << qint32(rect.width) << qint32(rect.height) << quint32(0);
+                    byte.append((const char *)buf.data(), buf.size());
+                    // 最高字节是消息类型, 1表示带人脸框的帧
+                    backsize = (quint64(1) << 56) | quint64(byte.size());
+                }
                 QByteArray sendData;
                 QDataStream stream(&sendData, QIODevice::WriteOnly);
                 stream.setVersion(QDataStream::Qt_5_14);
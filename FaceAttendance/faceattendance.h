@@ -10,6 +10,8 @@
 #include <QNetworkReply>
 #include <QNetworkRequest>
 #include <QUrl>
+#include <seeta/FaceLandmarker.h>
+#include <seeta/FaceRecognizer.h>
 
 using namespace cv;
 using namespace std;
@@ -46,6 +48,9 @@ private slots:
     void processJpegFrame(const QByteArray &jpegData);
 
 private:
+    // 在本机提取人脸特征, 成功返回编码好的特征数据
+    bool extractEmbedding(const cv::Mat &image, const cv::Rect &rect, QByteArray &embedding);
+
     Ui::FaceAttendance *ui;
 
     // haar--级联分类器
@@ -68,6 +73,13 @@ private:
     // 保存 人脸的数据
     cv::Mat faceMat;
 
+    // 本机提取特征: 只发送特征, 服务器只查特征库
+    // 模型加载失败或者服务器不接受这个模型的特征时改回发送图片
+    bool sendEmbedding;
+    int embeddingModel;     // 本机识别模型的编号
+    seeta::FaceLandmarker *landmarker;
+    seeta::FaceRecognizer *recognizer;
+
     // 串口
     QSerialPort *serial;
 